@@ -11,7 +11,10 @@ else
   time_cmd="/usr/bin/time -v"
 fi
 bench_exe="./build/bonsais"
-file_name="sample.txt"
+file_name="sample.txt.bz2"
+if [ -f sample.txt ]; then
+  file_name="sample.txt" # decompressed by 00_prepare.sh if the build lacks bzip2
+fi
 num_nodes="8575826"
 
 for lf in 0.8 0.9
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+echo_and_do() {
+  echo "$1"
+  eval "$1"
+}
+
+if [ "$(uname)" = "Darwin" ]; then
+  time_cmd="/usr/bin/time -l"
+else
+  time_cmd="/usr/bin/time -v"
+fi
+bench_exe="./build/bonsais"
+file_name="sample.txt.bz2"
+if [ -f sample.txt ]; then
+  file_name="sample.txt" # decompressed by 00_prepare.sh if the build lacks bzip2
+fi
+num_nodes="7000000000" # more than 2^33 slots in 0.8 load factor (about 17 GiB each)
+
+echo_and_do "$time_cmd $bench_exe $file_name $file_name 1 $num_nodes 0.8 5"
+echo_and_do "$time_cmd $bench_exe $file_name $file_name 2 $num_nodes 0.8 6"
+
+# the same tables mapped to files with 1,000 keys, which checks the position arithmetic beyond 2^33 slots
+# on machines with less memory (writing about 17 GiB to each file)
+bzcat $file_name | head -n 1000 > sample_1k.txt
+echo_and_do "$time_cmd $bench_exe sample_1k.txt sample_1k.txt 1 $num_nodes 0.8 5 --file slots.bin"
+echo_and_do "$time_cmd $bench_exe sample_1k.txt sample_1k.txt 2 $num_nodes 0.8 6 --file slots.bin"
+rm -f slots.bin
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+echo_and_do() {
+  echo "$1"
+  eval "$1"
+}
+
+if [ "$(uname)" = "Darwin" ]; then
+  time_cmd="/usr/bin/time -l"
+else
+  time_cmd="/usr/bin/time -v"
+fi
+bench_exe="./build/bonsais"
+file_name="sample.txt.bz2"
+if [ -f sample.txt ]; then
+  file_name="sample.txt" # decompressed by 00_prepare.sh if the build lacks bzip2
+fi
+num_nodes="8575826"
+
+# saturated collision groups of BonsaiDCW spill to a table ("num spills" in the stats)
+for cb in 2 3 5
+do
+  for lf in 0.8 0.85 0.9 0.95 0.97
+  do
+    echo_and_do "$time_cmd $bench_exe $file_name $file_name 1 $num_nodes $lf $cb";
+  done
+done
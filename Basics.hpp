@@ -3,7 +3,9 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -12,7 +14,9 @@
 #include <stdint.h>
 #include <sstream>
 #include <cmath>
+#include <cstring>
 #include <memory>
+#include <thread>
 
 namespace bonsais {
 
@@ -26,6 +30,130 @@ struct HashValue {
   uint64_t quo;
 };
 
+enum class Times {
+  sec, milli, micro, nano
+};
+
+class StopWatch {
+public:
+  StopWatch() : tp_(std::chrono::high_resolution_clock::now()) {}
+  ~StopWatch() {}
+
+  double operator()(Times type) const {
+    auto tp = std::chrono::high_resolution_clock::now() - tp_;
+    switch (type) {
+      case Times::sec:
+        return std::chrono::duration<double>(tp).count();
+      case Times::milli:
+        return std::chrono::duration<double, std::milli>(tp).count();
+      case Times::micro:
+        return std::chrono::duration<double, std::micro>(tp).count();
+      case Times::nano:
+        return std::chrono::duration<double, std::nano>(tp).count();
+    }
+    return 0.0;
+  }
+
+  StopWatch(const StopWatch&) = delete;
+  StopWatch& operator=(const StopWatch&) = delete;
+
+private:
+  std::chrono::high_resolution_clock::time_point tp_;
+};
+
+// Counter of events from many threads, where each thread increments its own shard in a separate cache line
+// (shared by threads beyond kNumShards), so that counting on every lookup does not contend.
+class ShardedCounter {
+public:
+  static constexpr uint32_t kNumShards = 32;
+
+  ShardedCounter() {}
+  ~ShardedCounter() {}
+
+  void add(uint64_t n = 1) {
+    shards_[shard_id_()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t get() const {
+    uint64_t ret = 0;
+    for (const auto& shard : shards_) {
+      ret += shard.value.load(std::memory_order_relaxed);
+    }
+    return ret;
+  }
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+private:
+  struct Shard {
+    std::atomic<uint64_t> value{0};
+    char pad[64 - sizeof(std::atomic<uint64_t>)]; // keeping values in different cache lines wherever shards_ starts
+  };
+  std::array<Shard, kNumShards> shards_;
+
+  static uint32_t shard_id_() {
+    static std::atomic<uint32_t> num_threads{0};
+    thread_local const uint32_t id = num_threads.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+    return id;
+  }
+};
+
+template<typename T>
+inline void write_value(std::ostream& os, const T& val) {
+  static_assert(Is_pod<T>(), "T is not POD.");
+  os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<typename T>
+inline void read_value(std::istream& is, T& val) {
+  static_assert(Is_pod<T>(), "T is not POD.");
+  is.read(reinterpret_cast<char*>(&val), sizeof(T));
+}
+
+// Returns the bytes taken by allocating num_bytes with glibc's malloc, which adds a header of 8 bytes and
+// rounds up to 16 bytes (32 at least), or maps whole pages from the mmap threshold of 128 KiB by default.
+inline uint64_t heap_bytes(uint64_t num_bytes) {
+  constexpr uint64_t kMmapThreshold = UINT64_C(1) << 17;
+  constexpr uint64_t kPageSize = UINT64_C(1) << 12;
+  if (kMmapThreshold <= num_bytes) {
+    return (num_bytes + 16 + kPageSize - 1) / kPageSize * kPageSize;
+  }
+  return std::max<uint64_t>((num_bytes + 8 + 15) / 16 * 16, 32);
+}
+
+// Returns the bytes taken by the nodes of a std::map, each with a color, three pointers and the value.
+template<typename Map>
+uint64_t map_bytes(const Map& map) {
+  return map.size() * heap_bytes(4 * sizeof(void*) + sizeof(typename Map::value_type));
+}
+
+// Memory taken by the components of a trie, including allocator overhead and unused capacity.
+struct MemoryUsage {
+  uint64_t slots = 0;
+  uint64_t auxs = 0; // for exceeding displacement values or spilled nodes
+  uint64_t filter = 0;
+  uint64_t cache = 0;
+  uint64_t counts = 0;
+  uint64_t others = 0; // the trie object itself
+
+  uint64_t total() const {
+    return slots + auxs + filter + cache + counts + others;
+  }
+
+  void show(std::ostream& os, uint64_t num_nodes, uint64_t num_strs) const {
+    os << "memory slots:  " << slots << std::endl;
+    os << "memory auxs:   " << auxs << std::endl;
+    os << "memory filter: " << filter << std::endl;
+    os << "memory cache:  " << cache << std::endl;
+    os << "memory counts: " << counts << std::endl;
+    os << "memory others: " << others << std::endl;
+    os << "memory total:  " << total() << std::endl;
+    os << "bytes/node:    " << static_cast<double>(total()) / num_nodes << std::endl;
+    os << "bytes/key:     " << (num_strs == 0 ? 0.0 : static_cast<double>(total()) / num_strs) << std::endl;
+  }
+};
+
 inline uint8_t num_bits(uint64_t n) {
   uint8_t ret = 0;
   do {
@@ -35,18 +163,87 @@ inline uint8_t num_bits(uint64_t n) {
   return ret;
 }
 
-inline bool is_prime(uint64_t n) {
-  if (n == 2) {
-    return true;
+inline uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t mod) {
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % mod);
+}
+
+inline uint64_t pow_mod(uint64_t base, uint64_t exp, uint64_t mod) {
+  uint64_t ret = 1;
+  base %= mod;
+  while (exp != 0) {
+    if (exp & 1U) {
+      ret = mul_mod(ret, base, mod);
+    }
+    base = mul_mod(base, base, mod);
+    exp >>= 1;
   }
+  return ret;
+}
+
+// MurmurHash64A by Austin Appleby.
+inline uint64_t hash_bytes(const void* data, uint64_t size, uint64_t seed = 0) {
+  constexpr uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+  constexpr int r = 47;
+
+  const auto bytes = static_cast<const uint8_t*>(data);
+  uint64_t h = seed ^ (size * m);
 
-  if (n % 2 == 0 || n <= 1) {
+  uint64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t k = 0;
+    std::memcpy(&k, bytes + i, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  if (i < size) {
+    for (uint64_t j = size; i < j; --j) {
+      h ^= static_cast<uint64_t>(bytes[j - 1]) << (8 * (j - 1 - i));
+    }
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Deterministic Miller-Rabin test for 64-bit integers.
+inline bool is_prime(uint64_t n) {
+  constexpr uint64_t kBases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+  if (n < 2) {
     return false;
   }
+  for (auto base : kBases) {
+    if (n % base == 0) {
+      return n == base;
+    }
+  }
+
+  uint64_t d = n - 1;
+  uint32_t s = 0;
+  while (d % 2 == 0) {
+    d >>= 1;
+    ++s;
+  }
 
-  auto max = static_cast<uint64_t>(std::sqrt(n));
-  for (uint64_t i = 3; i <= max; i += 2) {
-    if (n % i == 0) {
+  for (auto base : kBases) {
+    uint64_t x = pow_mod(base, d, n);
+    if (x == 1 || x == n - 1) {
+      continue;
+    }
+    uint32_t r = 1;
+    for (; r < s; ++r) {
+      x = mul_mod(x, x, n);
+      if (x == n - 1) {
+        break;
+      }
+    }
+    if (r == s) {
       return false;
     }
   }
@@ -67,6 +264,109 @@ inline uint64_t greater_prime(uint64_t n) {
   return ret;
 }
 
+// Returns the prime used for hashing codes in [0, max_code], which must leave room below 2^64.
+inline uint64_t code_prime(unsigned __int128 max_code) {
+  if (static_cast<unsigned __int128>(UINT64_MAX - (UINT64_C(1) << 32)) < max_code) {
+    std::cerr << "ERROR: too large num_slots * alp_size" << std::endl;
+    exit(1);
+  }
+  return greater_prime(static_cast<uint64_t>(max_code));
+}
+
+// Sorts items stably by the lowest num_key_bits bits of key_of(item) with LSD radix sort.
+template<typename T, typename F>
+void radix_sort(std::vector<T>& items, std::vector<T>& buf, uint8_t num_key_bits, F key_of) {
+  constexpr uint8_t kDigitBits = 11;
+  constexpr uint64_t kDigitMask = (1U << kDigitBits) - 1;
+
+  assert(num_key_bits <= 64);
+
+  if (items.size() < (1U << kDigitBits)) {
+    std::stable_sort(items.begin(), items.end(), [&](const T& a, const T& b) {
+      return key_of(a) < key_of(b);
+    });
+    return;
+  }
+
+  buf.resize(items.size());
+  std::vector<uint64_t> counts(kDigitMask + 1);
+
+  for (uint8_t shift = 0; shift < num_key_bits; shift += kDigitBits) {
+    std::fill(counts.begin(), counts.end(), 0);
+    for (const auto& item : items) {
+      ++counts[(key_of(item) >> shift) & kDigitMask];
+    }
+    uint64_t sum = 0;
+    for (auto& count : counts) {
+      auto tmp = count;
+      count = sum;
+      sum += tmp;
+    }
+    for (const auto& item : items) {
+      buf[counts[(key_of(item) >> shift) & kDigitMask]++] = item;
+    }
+    items.swap(buf);
+  }
+}
+
+// Returns the p-th percentile, reordering values.
+inline double percentile(std::vector<double>& values, double p) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  const auto nth = values.begin() + static_cast<uint64_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+
+// Splits [0, num) into num_threads ranges and calls fn(thread_id, begin, end) for each in parallel.
+template<typename F>
+void parallel_for(uint64_t num, uint32_t num_threads, F fn) {
+  num_threads = std::max<uint32_t>(num_threads, 1);
+  const uint64_t step = (num + num_threads - 1) / num_threads;
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    const auto begin = std::min(num, i * step);
+    threads.emplace_back(fn, i, begin, std::min(num, begin + step));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Runs walks for [0, num) interleaving kNumWalks of them, so that each step can prefetch for the next one.
+// start(i, walk) initializes the i-th walk and returns false if it needs no steps,
+// and step(walk) advances the walk and returns false at its end.
+template<typename Walk, typename Start, typename Step>
+void interleave_walks(uint64_t num, Start start, Step step) {
+  constexpr uint64_t kNumWalks = 16;
+
+  Walk walks[kNumWalks];
+  uint64_t next = 0, num_walks = 0;
+  auto restart = [&](Walk& walk) {
+    while (next < num) {
+      if (start(next++, walk)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  while (num_walks < kNumWalks && restart(walks[num_walks])) {
+    ++num_walks;
+  }
+  while (num_walks != 0) {
+    for (uint64_t i = 0; i < num_walks;) {
+      if (step(walks[i]) || restart(walks[i])) {
+        ++i;
+      } else {
+        walks[i] = walks[--num_walks];
+      }
+    }
+  }
+}
+
 } //bonsais
 
 #endif //BONSAIS_BASICS_HPP
@@ -0,0 +1,111 @@
+#ifndef BONSAIS_BLOOM_FILTER_HPP
+#define BONSAIS_BLOOM_FILTER_HPP
+
+#include "ChunkBuffer.hpp"
+
+namespace bonsais {
+
+/*
+ * Blocked Bloom filter for rejecting absent strings before walking a trie.
+ * Each string sets one bit in each of the 8 words of a 64-byte block (split block Bloom filter),
+ * so a lookup reads a single cache line.
+ * */
+class BloomFilter {
+public:
+  static constexpr uint64_t kBlockWidth = 512;
+  static constexpr uint64_t kWordsPerBlock = 8;
+  static constexpr uint64_t kMinCapacity = 1U << 16; // when rebuilt for more strings
+
+  BloomFilter(uint64_t capacity, uint8_t bits_per_key, const VectorConfig& config = VectorConfig{})
+      : capacity_{capacity}, bits_per_key_{bits_per_key} {
+    num_blocks_ = std::max<uint64_t>((capacity * bits_per_key + kBlockWidth - 1) / kBlockWidth, 1);
+    ChunkBuffer(num_blocks_ * kWordsPerBlock, config).swap(words_);
+  }
+  ~BloomFilter() {}
+
+  void add(const void* data, uint64_t size) {
+    const auto h = hash_bytes(data, size);
+    auto block = words_.data() + block_pos_(h) * kWordsPerBlock;
+    for (uint64_t i = 0; i < kWordsPerBlock; ++i) {
+      block[i] |= mask_(h, i);
+    }
+  }
+
+  bool contains(const void* data, uint64_t size) const {
+    const auto h = hash_bytes(data, size);
+    const auto block = words_.data() + block_pos_(h) * kWordsPerBlock;
+    for (uint64_t i = 0; i < kWordsPerBlock; ++i) {
+      if ((block[i] & mask_(h, i)) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Same as !contains(), counting the rejects.
+  bool rejects(const void* data, uint64_t size) const {
+    if (contains(data, size)) {
+      return false;
+    }
+    num_rejects_.add();
+    return true;
+  }
+
+  // To be called when a string passing the filter is not found.
+  void count_false_positive() const {
+    num_false_positives_.add();
+  }
+
+  // #strings the filter is sized for, beyond which the false positive rate exceeds that designed
+  uint64_t capacity() const { return capacity_; }
+  uint8_t bits_per_key() const { return bits_per_key_; }
+
+  uint64_t num_rejects() const {
+    return num_rejects_.get();
+  }
+  uint64_t num_false_positives() const {
+    return num_false_positives_.get();
+  }
+  // among absent strings looked up
+  double false_positive_rate() const {
+    const auto num_negatives = num_rejects() + num_false_positives();
+    return num_negatives == 0 ? 0.0 : static_cast<double>(num_false_positives()) / num_negatives;
+  }
+
+  uint64_t size_in_bytes() const {
+    return words_.size() * sizeof(uint64_t) + sizeof(num_blocks_);
+  }
+  // including the object allocated on the heap and allocator overhead
+  uint64_t allocated_bytes() const {
+    return heap_bytes(sizeof(*this)) + words_.allocated_bytes();
+  }
+
+  BloomFilter(const BloomFilter&) = delete;
+  BloomFilter& operator=(const BloomFilter&) = delete;
+
+private:
+  ChunkBuffer words_;
+  uint64_t num_blocks_ = 0;
+  uint64_t capacity_ = 0;
+  uint8_t bits_per_key_ = 0;
+  mutable ShardedCounter num_rejects_;
+  mutable ShardedCounter num_false_positives_;
+
+  // by the upper bits of h
+  uint64_t block_pos_(uint64_t h) const {
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(h) * num_blocks_) >> 64);
+  }
+
+  // by the lower 32 bits of h, which are almost independent of block_pos_()
+  static uint64_t mask_(uint64_t h, uint64_t i) {
+    static constexpr uint32_t kSalts[kWordsPerBlock] = {
+      0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+    return UINT64_C(1) << ((static_cast<uint32_t>(h) * kSalts[i]) >> 26);
+  }
+};
+
+} //bonsais
+
+#endif //BONSAIS_BLOOM_FILTER_HPP
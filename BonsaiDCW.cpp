@@ -1,8 +1,10 @@
 #include "BonsaiDCW.hpp"
+#include "Merge.hpp"
 
 namespace bonsais {
 
-BonsaiDCW::BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits) {
+BonsaiDCW::BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits,
+                     const VectorConfig& config) {
   num_strs_ = 0;
   num_slots_ = num_slots;
   num_nodes_ = 1;
@@ -12,8 +14,11 @@ BonsaiDCW::BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits)
   root_id_ = {num_slots_ / 2, 0, num_slots_ / 2}; // without a particular reason
   empty_mark_ = alp_size * colls_limit_ + 2; // greater than the maximum quotient value expected
 
-  prime_ = greater_prime(alp_size * colls_limit_ * num_slots_ + num_slots_ - 1);
-  multiplier_ = UINT64_MAX / prime_; // Todo: support invertible
+  prime_ = code_prime(static_cast<unsigned __int128>(alp_size) * colls_limit_ * num_slots_ + num_slots_ - 1);
+  multiplier_ = UINT64_MAX / prime_;
+  if (multiplier_ % prime_ == 0) { // keeping the hash function invertible
+    --multiplier_;
+  }
 
   if (num_bits(alp_size * colls_limit_ - 1) < num_bits(empty_mark_)) {
     std::cerr << "#bits required for alp_size * colls_limit < #bits allocated" << std::endl;
@@ -21,7 +26,7 @@ BonsaiDCW::BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits)
     std::cerr << "The latter is " << (uint32_t) num_bits(empty_mark_) << std::endl;
   }
 
-  FitVector(num_slots, num_bits(empty_mark_) + 3, (empty_mark_ << 3) | (1U << 1)).swap(slots_);
+  FitVector(num_slots, num_bits(empty_mark_) + 3, (empty_mark_ << 3) | (1U << 1), config).swap(slots_);
   table_.fill(UINT8_MAX);
 
   set_quo_(root_id_.init_pos, 0); // other than empty_mark_
@@ -29,29 +34,51 @@ BonsaiDCW::BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits)
 }
 
 bool BonsaiDCW::search(const uint8_t* str, uint64_t len) const {
+  if (filter_ && filter_->rejects(str, len)) {
+    return false;
+  }
+
   auto node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
     if (table_[str[i]] == UINT8_MAX) {
-      return false;
+      return count_miss_();
     }
     if (!get_child_(node_id, static_cast<uint64_t>(table_[str[i]]))) {
-      return false;
+      return count_miss_();
     }
   }
-  return get_fbit_(node_id.slot_pos);
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  return get_fbit_(node_id.slot_pos) || count_miss_();
 }
 
 bool BonsaiDCW::insert(const uint8_t* str, uint64_t len) {
+  if (log_ != nullptr) {
+    log_->append(str, len);
+  }
+  if (filter_) {
+    filter_->add(str, len);
+  }
+
   auto node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
-    if (table_[str[i]] == UINT8_MAX) {
-      table_[str[i]] = alp_count_++;
-      if (alp_size_ <= alp_count_) {
-        std::cerr << "ERROR: alp_size_ < alp_count_" << std::endl;
-        exit(1);
-      }
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return get_code_(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
+    const auto symbol = get_code_(str[i]);
+    add_child_(node_id, symbol);
+    if (tag != 0) {
+      tag = cache_->extend_tag(tag, symbol);
+      store_(tag, node_id);
     }
-    add_child_(node_id, static_cast<uint64_t>(table_[str[i]]));
+  }
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  if (counts_) {
+    increment_count_(node_id.slot_pos);
   }
 
   if (get_fbit_(node_id.slot_pos)) {
@@ -60,9 +87,111 @@ bool BonsaiDCW::insert(const uint8_t* str, uint64_t len) {
 
   set_fbit_(node_id.slot_pos, true);
   ++num_strs_;
+  grow_filter_();
   return true;
 }
 
+void BonsaiDCW::search_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num, bool* found) const {
+  struct Walk {
+    uint64_t str_id;
+    uint64_t depth;
+    NodeID node_id;
+  };
+
+  // prefetches the slot of the next child, or sets the result at the end
+  auto next = [&](Walk& walk) {
+    const auto str = strs[walk.str_id];
+    if (walk.depth == lens[walk.str_id]) {
+      if (walk.node_id.slot_pos == kNotFound) {
+        walk.node_id.slot_pos = locate_(walk.node_id);
+      }
+      found[walk.str_id] = get_fbit_(walk.node_id.slot_pos) || count_miss_();
+      return false;
+    }
+    if (table_[str[walk.depth]] == UINT8_MAX) {
+      found[walk.str_id] = count_miss_();
+      return false;
+    }
+    prefetch_child_(walk.node_id, table_[str[walk.depth]]);
+    return true;
+  };
+
+  interleave_walks<Walk>(num, [&](uint64_t i, Walk& walk) {
+    if (filter_ && filter_->rejects(strs[i], lens[i])) {
+      found[i] = false;
+      return false;
+    }
+    uint64_t tag = 0;
+    walk = {i, 0, root_id_};
+    walk.depth = jump_(lens[i], [&](uint64_t j) { return table_[strs[i][j]]; }, walk.node_id, tag);
+    return next(walk);
+  }, [&](Walk& walk) {
+    if (!get_child_(walk.node_id, table_[strs[walk.str_id][walk.depth]])) {
+      found[walk.str_id] = count_miss_();
+      return false;
+    }
+    ++walk.depth;
+    return next(walk);
+  });
+}
+
+uint64_t BonsaiDCW::count(const uint8_t* str, uint64_t len) const {
+  auto node_id = root_id_;
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
+    if (table_[str[i]] == UINT8_MAX || !get_child_(node_id, table_[str[i]])) {
+      return 0;
+    }
+  }
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  if (!get_fbit_(node_id.slot_pos)) {
+    return 0;
+  }
+  return counts_ ? get_count_(node_id.slot_pos) : 1;
+}
+
+bool BonsaiDCW::contains_prefix(const uint8_t* str, uint64_t len) const {
+  auto node_id = root_id_;
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
+    if (table_[str[i]] == UINT8_MAX || !get_child_(node_id, table_[str[i]])) {
+      return false;
+    }
+  }
+  return num_strs_ != 0;
+}
+
+bool BonsaiDCW::child(Cursor& cursor, uint8_t c) const {
+  return table_[c] != UINT8_MAX && get_child_(cursor, table_[c]);
+}
+
+uint64_t BonsaiDCW::advance(Cursor& cursor, const uint8_t* str, uint64_t len) const {
+  uint64_t i = 0;
+  while (i < len && child(cursor, str[i])) {
+    ++i;
+  }
+  return i;
+}
+
+uint64_t BonsaiDCW::insert_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num) {
+  for (uint64_t i = 0; i < num; ++i) {
+    if (log_ != nullptr) {
+      log_->append(strs[i], lens[i]);
+    }
+    if (filter_) {
+      filter_->add(strs[i], lens[i]);
+    }
+  }
+
+  return insert_all_(lens, num, [&](uint64_t i, uint64_t depth) {
+    return get_code_(strs[i][depth]);
+  });
+}
+
 void BonsaiDCW::show_stat(std::ostream& os) const {
   os << "Bonsai stat." << std::endl;
   os << "num slots:   " << num_slots_ << std::endl;
@@ -70,22 +199,318 @@ void BonsaiDCW::show_stat(std::ostream& os) const {
   os << "load factor: " << static_cast<double>(num_nodes_) / num_slots_ << std::endl;
   os << "alp size:    " << alp_size_ << std::endl;
   os << "colls limit: " << colls_limit_ << std::endl;
+  os << "num spills:  " << spill_keys_.size() << std::endl;
+  os << "blocked:     " << slots_.blocked() << std::endl;
+  os << "page size:   " << slots_.page_size() << std::endl;
+  os << "file backed: " << slots_.file_backed() << std::endl;
+  if (filter_) {
+    os << "size filter: " << filter_->size_in_bytes() << std::endl;
+    os << "filter rejects: " << filter_->num_rejects() << std::endl;
+    os << "filter FP rate: " << filter_->false_positive_rate() << std::endl;
+  }
+  if (counts_) {
+    os << "size counts: " << counts_->size_in_bytes() << std::endl;
+    os << "count overflows: " << counts_->num_overflows() << std::endl;
+  }
+  if (cache_) {
+    os << "size cache:  " << cache_->size_in_bytes() << std::endl;
+    os << "cache hit rate: " << cache_->hit_rate() << std::endl;
+    os << "cache skipped depth: " << cache_->skipped_depth() << std::endl;
+  }
   os << "size slots:  " << slots_.size_in_bytes() << std::endl;
+  memory_usage().show(os, num_nodes_, num_strs_);
+}
+
+MemoryUsage BonsaiDCW::memory_usage() const {
+  MemoryUsage ret;
+  ret.slots = slots_.allocated_bytes();
+  ret.auxs = map_bytes(spill_map_) + map_bytes(spill_child_map_) + heap_bytes(spill_keys_.capacity() * sizeof(uint64_t))
+      + heap_bytes((spill_nested_.capacity() + 7) / 8) + heap_bytes((spill_fbits_.capacity() + 7) / 8);
+  ret.filter = filter_ ? filter_->allocated_bytes() : 0;
+  ret.cache = cache_ ? cache_->allocated_bytes() : 0;
+  ret.counts = counts_ ? counts_->allocated_bytes() + heap_bytes(spill_counts_.capacity() * sizeof(uint64_t)) : 0;
+  ret.others = sizeof(*this);
+  return ret;
+}
+
+void BonsaiDCW::enable_filter(uint64_t capacity, uint8_t bits_per_key) {
+  if (typed_) {
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  filter_.reset(new BloomFilter{capacity, bits_per_key});
+
+  std::vector<std::string> keys;
+  enumerate(keys, std::max(std::thread::hardware_concurrency(), 1U));
+  for (const auto& key : keys) {
+    filter_->add(key.data(), key.size());
+  }
+}
+
+// Rebuilds the filter for twice the strings once they exceed its capacity.
+void BonsaiDCW::grow_filter_() {
+  if (filter_ && filter_->capacity() < num_strs_) {
+    enable_filter(std::max(2 * num_strs_, BloomFilter::kMinCapacity), filter_->bits_per_key());
+  }
+}
+
+void BonsaiDCW::enable_counts(uint8_t width) {
+  counts_.reset(new CountVector{num_slots_, width});
+  spill_counts_.assign(spill_keys_.size(), 0);
+}
+
+void BonsaiDCW::enable_prefix_cache(uint8_t depth, uint64_t num_entries) {
+  cache_.reset(new PrefixCache{depth, num_entries});
+  if (typed_) {
+    return; // not restored by enumeration
+  }
+
+  std::vector<std::string> keys;
+  enumerate(keys, std::max(std::thread::hardware_concurrency(), 1U));
+  for (const auto& key : keys) {
+    auto node_id = root_id_;
+    uint64_t tag = PrefixCache::kEmptyTag;
+    for (uint64_t i = 0; i < key.size(); ++i) {
+      const uint64_t symbol = table_[static_cast<uint8_t>(key[i])];
+      if ((tag = cache_->extend_tag(tag, symbol)) == 0) {
+        break;
+      }
+      get_child_(node_id, symbol);
+      store_(tag, node_id);
+    }
+  }
+}
+
+void BonsaiDCW::save(std::ostream& os) const {
+  write_value(os, num_strs_);
+  write_value(os, num_slots_);
+  write_value(os, num_nodes_);
+  write_value(os, alp_size_);
+  write_value(os, colls_limit_);
+  write_value(os, root_id_);
+  write_value(os, empty_mark_);
+  write_value(os, prime_);
+  write_value(os, multiplier_);
+  slots_.save(os);
+  write_value(os, static_cast<uint64_t>(spill_keys_.size()));
+  for (uint64_t i = 0; i < spill_keys_.size(); ++i) {
+    write_value(os, spill_keys_[i]);
+    write_value(os, static_cast<bool>(spill_nested_[i]));
+    write_value(os, static_cast<bool>(spill_fbits_[i]));
+  }
+  write_value(os, table_);
+  write_value(os, alp_count_);
+  write_value(os, typed_);
+  write_value(os, counts_ != nullptr);
+  if (counts_) {
+    counts_->save(os);
+    for (const auto count : spill_counts_) {
+      write_value(os, count);
+    }
+  }
+}
+
+void BonsaiDCW::load(std::istream& is) {
+  read_value(is, num_strs_);
+  read_value(is, num_slots_);
+  read_value(is, num_nodes_);
+  read_value(is, alp_size_);
+  read_value(is, colls_limit_);
+  read_value(is, root_id_);
+  read_value(is, empty_mark_);
+  read_value(is, prime_);
+  read_value(is, multiplier_);
+  slots_.load(is);
+  uint64_t num_spills = 0;
+  read_value(is, num_spills);
+  spill_map_.clear();
+  spill_child_map_.clear();
+  spill_keys_.resize(num_spills);
+  spill_nested_.resize(num_spills);
+  spill_fbits_.resize(num_spills);
+  for (uint64_t i = 0; i < num_spills && is; ++i) {
+    bool nested = false, fbit = false;
+    read_value(is, spill_keys_[i]);
+    read_value(is, nested);
+    read_value(is, fbit);
+    spill_nested_[i] = nested;
+    spill_fbits_[i] = fbit;
+    (nested ? spill_child_map_ : spill_map_).insert({spill_keys_[i], i});
+  }
+  read_value(is, table_);
+  read_value(is, alp_count_);
+  read_value(is, typed_);
+  bool has_counts = false;
+  read_value(is, has_counts);
+  counts_.reset(has_counts ? new CountVector : nullptr);
+  spill_counts_.clear();
+  if (counts_) {
+    counts_->load(is);
+    spill_counts_.resize(num_spills);
+    for (auto& count : spill_counts_) {
+      read_value(is, count);
+    }
+  }
+  filter_.reset(); // not covering the loaded strings
+  cache_.reset();
+
+  if (!is) {
+    std::cerr << "ERROR: failed to load " << name() << std::endl;
+    exit(1);
+  }
+}
+
+void BonsaiDCW::enumerate(std::vector<std::string>& keys, uint32_t num_threads) const {
+  const auto inverse = pow_mod(multiplier_ % prime_, prime_ - 2, prime_); // multiplier_ is coprime to prime_
+  const auto bytes = get_bytes_();
+
+  FitVector starts, homes;
+  index_groups_(starts, homes);
+
+  auto is_root = [&](const NodeID& node_id) {
+    return node_id.init_pos == root_id_.init_pos && node_id.num_colls == 0;
+  };
+
+  if (get_fbit_(starts.get(root_id_.init_pos))) {
+    keys.emplace_back();
+  }
+
+  walk_up_keys<NodeID>(num_slots_ + spill_keys_.size(), num_threads, [&](uint64_t pos, NodeID& node_id) {
+    if (num_slots_ <= pos) {
+      node_id = {pos - num_slots_, colls_limit_, pos};
+      return get_fbit_(pos);
+    }
+    if (get_quo_(pos) == empty_mark_ || !get_fbit_(pos)) {
+      return false;
+    }
+    uint64_t start = pos, num_colls = 0;
+    for (; !get_cbit_(start); start = left_(start)) {
+      ++num_colls;
+    }
+    node_id = {homes.get(start), num_colls, pos};
+    return !is_root(node_id);
+  }, [&](NodeID& node_id) {
+    if (node_id.slot_pos == kNotFound && is_spilled_(node_id)) {
+      node_id.slot_pos = locate_(node_id);
+    } else if (node_id.slot_pos == kNotFound) { // locating the parent in two steps
+      node_id.slot_pos = (starts.get(node_id.init_pos) + node_id.num_colls) % num_slots_;
+      slots_.prefetch(node_id.slot_pos);
+      return -1;
+    }
+    uint64_t symbol = 0;
+    node_id = get_parent_(node_id, inverse, symbol);
+    starts.prefetch(node_id.init_pos);
+    return static_cast<int>(bytes[symbol]);
+  }, is_root, keys);
+}
+
+// Returns the code of c, assigning a new one if not registered.
+uint64_t BonsaiDCW::get_code_(uint8_t c) {
+  if (table_[c] == UINT8_MAX) {
+    table_[c] = alp_count_++;
+    if (alp_size_ <= alp_count_) {
+      std::cerr << "ERROR: alp_size_ < alp_count_" << std::endl;
+      exit(1);
+    }
+  }
+  return table_[c];
 }
 
 // expecting 0 <= quo <= alp_size + 1
 HashValue BonsaiDCW::hash_(const NodeID& node_id, uint64_t symbol) const {
+  // c < prime_ and multiplier_ <= UINT64_MAX / prime_, so the product fits in 64 bits
   uint64_t c = (symbol * colls_limit_ + node_id.num_colls) * num_slots_ + node_id.init_pos;
   uint64_t crnd = ((c % prime_) * multiplier_) % prime_; // avoiding overflow
   return {crnd % num_slots_, crnd / num_slots_};
 }
 
+// Returns the parent of the node whose slot_pos is valid and sets the symbol on the edge to it,
+// where 'inverse' is that of multiplier_ modulo prime_. The slot_pos of the parent is left kNotFound
+// unless it is spilled.
+BonsaiDCW::NodeID BonsaiDCW::get_parent_(const NodeID& node_id, uint64_t inverse, uint64_t& symbol) const {
+  uint64_t code = 0;
+  if (num_slots_ <= node_id.slot_pos) {
+    code = spill_keys_[node_id.init_pos];
+    if (spill_nested_[node_id.init_pos]) {
+      symbol = code % alp_size_;
+      return {code / alp_size_, colls_limit_, num_slots_ + code / alp_size_};
+    }
+  } else {
+    code = get_quo_(node_id.slot_pos) * num_slots_ + node_id.init_pos;
+  }
+  const uint64_t c = mul_mod(code, inverse, prime_);
+  symbol = c / num_slots_ / colls_limit_;
+  return {c % num_slots_, (c / num_slots_) % colls_limit_, kNotFound};
+}
+
+std::vector<uint8_t> BonsaiDCW::get_bytes_() const {
+  std::vector<uint8_t> bytes(alp_size_);
+  for (uint64_t i = 0; i < alp_size_; ++i) {
+    bytes[i] = static_cast<uint8_t>(i);
+  }
+  for (uint64_t c = 0; c < table_.size(); ++c) {
+    if (table_[c] != UINT8_MAX) {
+      bytes[table_[c]] = static_cast<uint8_t>(c);
+    }
+  }
+  return bytes;
+}
+
+// Sets the first slot of the collision group of each initial position to starts,
+// and the initial position of each group to homes at the first slot.
+// In a run of non-empty slots, the i-th virgin bit is associated with the i-th change bit.
+void BonsaiDCW::index_groups_(FitVector& starts, FitVector& homes) const {
+  uint64_t empty_pos = 0;
+  while (get_quo_(empty_pos) != empty_mark_) {
+    if (++empty_pos == num_slots_) {
+      std::cerr << "ERROR: no empty slot" << std::endl;
+      exit(1);
+    }
+  }
+
+  const uint8_t width = num_bits(num_slots_);
+  FitVector(num_slots_, width, 0).swap(starts);
+  FitVector(num_slots_, width, 0).swap(homes);
+
+  std::vector<uint64_t> vbit_poss, cbit_poss; // in the current run
+  uint64_t num_pairs = 0;
+  for (uint64_t i = 0, pos = empty_pos; i < num_slots_; ++i) {
+    pos = right_(pos);
+    if (get_quo_(pos) == empty_mark_) {
+      assert(vbit_poss.size() == cbit_poss.size());
+      vbit_poss.clear();
+      cbit_poss.clear();
+      num_pairs = 0;
+      continue;
+    }
+    if (get_vbit_(pos)) {
+      vbit_poss.push_back(pos);
+    }
+    if (get_cbit_(pos)) {
+      cbit_poss.push_back(pos);
+    }
+    for (; num_pairs < vbit_poss.size() && num_pairs < cbit_poss.size(); ++num_pairs) {
+      starts.set(vbit_poss[num_pairs], cbit_poss[num_pairs]);
+      homes.set(cbit_poss[num_pairs], vbit_poss[num_pairs]);
+    }
+  }
+}
+
 bool BonsaiDCW::get_child_(NodeID& node_id, uint64_t symbol) const {
   if (alp_size_ <= symbol) {
     std::cerr << "ERROR: out-of-range symbol" << std::endl;
     exit(1);
   }
 
+  if (is_spilled_(node_id)) {
+    auto it = spill_child_map_.find(node_id.init_pos * alp_size_ + symbol);
+    if (it == spill_child_map_.end()) {
+      return false;
+    }
+    node_id = {it->second, colls_limit_, num_slots_ + it->second};
+    return true;
+  }
+
   const auto hv = hash_(node_id, symbol);
   if (empty_mark_ <= hv.quo) {
     std::cerr << "ERROR: out-of-range hv.quo" << std::endl;
@@ -104,25 +529,50 @@ bool BonsaiDCW::get_child_(NodeID& node_id, uint64_t symbol) const {
 
   uint64_t num_colls = find_item_(pos, hv.quo);
   if (colls_limit_ <= num_colls) {
-    return false;
+    if (num_colls < 2 * colls_limit_) { // not saturated?
+      return false;
+    }
+    auto it = spill_map_.find(hv.quo * num_slots_ + hv.rem);
+    if (it == spill_map_.end()) {
+      return false;
+    }
+    node_id = {it->second, colls_limit_, num_slots_ + it->second};
+    return true;
   }
 
   node_id = {hv.rem, num_colls, pos};
   return true;
 }
 
+void BonsaiDCW::prefetch_child_(const NodeID& node_id, uint64_t symbol) const {
+  if (is_spilled_(node_id)) {
+    return;
+  }
+  const auto pos = hash_(node_id, symbol).rem;
+  slots_.prefetch(pos);
+  slots_.will_need(pos);
+}
+
 bool BonsaiDCW::add_child_(NodeID& node_id, uint64_t symbol) {
   if (alp_size_ <= symbol) {
     std::cerr << "ERROR: out-of-range symbol" << std::endl;
     exit(1);
   }
 
+  if (is_spilled_(node_id)) {
+    return spill_child_(node_id, symbol);
+  }
+
   const auto hv = hash_(node_id, symbol);
   if (empty_mark_ <= hv.quo) {
     std::cerr << "ERROR: out-of-range hv.quo" << std::endl;
     exit(1);
   }
 
+  return add_child_(node_id, hv);
+}
+
+bool BonsaiDCW::add_child_(NodeID& node_id, const HashValue& hv) {
   if (get_quo_(hv.rem) == empty_mark_) {
     // without collision
     update_slot_(hv.rem, hv.quo, true, true, false);
@@ -163,8 +613,7 @@ bool BonsaiDCW::add_child_(NodeID& node_id, uint64_t symbol) {
 
     num_colls -= colls_limit_; // get original
     if (colls_limit_ <= num_colls) {
-      std::cerr << "ERROR: exceeding #collisions" << std::endl;
-      exit(1);
+      return spill_(node_id, hv);
     }
 
     pos = left_(pos); // rightmost of the group
@@ -178,6 +627,9 @@ bool BonsaiDCW::add_child_(NodeID& node_id, uint64_t symbol) {
 
   set_quo_(empty_pos, hv.quo);
   set_fbit_(empty_pos, false);
+  if (counts_) {
+    counts_->clear(empty_pos); // left by the displaced node
+  }
 
   node_id = {hv.rem, num_colls, empty_pos};
   ++num_nodes_;
@@ -185,6 +637,48 @@ bool BonsaiDCW::add_child_(NodeID& node_id, uint64_t symbol) {
   return true;
 }
 
+// Finds or adds the node of a saturated collision group in the spill table.
+bool BonsaiDCW::spill_(NodeID& node_id, const HashValue& hv) {
+  const uint64_t code = hv.quo * num_slots_ + hv.rem;
+  auto it = spill_map_.find(code);
+  if (it != spill_map_.end()) {
+    node_id = {it->second, colls_limit_, num_slots_ + it->second};
+    return false;
+  }
+  spill_map_.insert({code, spill_keys_.size()});
+  node_id = append_spill_(code, false);
+  return true;
+}
+
+// Finds or adds the child of a spilled node, which is also spilled.
+bool BonsaiDCW::spill_child_(NodeID& node_id, uint64_t symbol) {
+  const uint64_t key = node_id.init_pos * alp_size_ + symbol;
+  auto it = spill_child_map_.find(key);
+  if (it != spill_child_map_.end()) {
+    node_id = {it->second, colls_limit_, num_slots_ + it->second};
+    return false;
+  }
+  spill_child_map_.insert({key, spill_keys_.size()});
+  node_id = append_spill_(key, true);
+  return true;
+}
+
+BonsaiDCW::NodeID BonsaiDCW::append_spill_(uint64_t key, bool nested) {
+  const uint64_t index = spill_keys_.size();
+  if (num_slots_ <= index) { // init_pos of the node
+    std::cerr << "ERROR: exceeding #spills" << std::endl;
+    exit(1);
+  }
+  spill_keys_.push_back(key);
+  spill_nested_.push_back(nested);
+  spill_fbits_.push_back(false);
+  if (counts_) {
+    spill_counts_.push_back(0);
+  }
+  ++num_nodes_;
+  return {index, colls_limit_, num_slots_ + index};
+}
+
 // Finds the change bit associated with 'pos' and returns it.
 // If not exist, returns kNotFound.
 // Future, returns the rightmost empty slot located on the left side of 'pos'.
@@ -236,6 +730,20 @@ uint64_t BonsaiDCW::find_item_(uint64_t& pos, uint64_t quo) const {
   return num_colls + colls_limit_;
 }
 
+// Returns the current slot position of the node.
+uint64_t BonsaiDCW::locate_(const NodeID& node_id) const {
+  if (is_spilled_(node_id)) {
+    return num_slots_ + node_id.init_pos;
+  }
+  uint64_t dummy{};
+  uint64_t pos = find_ass_cbit_pos_(node_id.init_pos, dummy);
+  assert(pos != kNotFound);
+  for (uint64_t i = 0; i < node_id.num_colls; ++i) {
+    pos = right_(pos);
+  }
+  return pos;
+}
+
 uint64_t BonsaiDCW::right_(uint64_t pos) const {
   return pos == num_slots_ - 1 ? 0 : pos + 1;
 }
@@ -248,6 +756,9 @@ uint64_t BonsaiDCW::left_(uint64_t pos) const {
 uint64_t BonsaiDCW::copy_from_right_(uint64_t pos) {
   auto _pos = right_(pos);
   slots_.set(pos, (slots_.get(_pos) & vbit_inv_mask_) | (get_vbit_(pos) << 2));
+  if (counts_) {
+    counts_->copy(_pos, pos);
+  }
   return _pos;
 }
 
@@ -264,6 +775,9 @@ bool BonsaiDCW::get_cbit_(uint64_t pos) const {
 }
 
 bool BonsaiDCW::get_fbit_(uint64_t pos) const {
+  if (num_slots_ <= pos) {
+    return spill_fbits_[pos - num_slots_];
+  }
   return (slots_.get(pos) & 1U) == 1U;
 }
 
@@ -280,6 +794,10 @@ void BonsaiDCW::set_cbit_(uint64_t pos, bool bit) {
 }
 
 void BonsaiDCW::set_fbit_(uint64_t pos, bool bit) {
+  if (num_slots_ <= pos) {
+    spill_fbits_[pos - num_slots_] = bit;
+    return;
+  }
   slots_.set(pos, (slots_.get(pos) & fbit_inv_mask_) | bit);
 }
 
@@ -287,4 +805,16 @@ void BonsaiDCW::update_slot_(uint64_t pos, uint64_t quo, bool vbit, bool cbit, b
   slots_.set(pos, (quo << 3) | (vbit << 2) | (cbit << 1) | fbit);
 }
 
+void BonsaiDCW::increment_count_(uint64_t pos) {
+  if (num_slots_ <= pos) {
+    ++spill_counts_[pos - num_slots_];
+  } else {
+    counts_->increment(pos);
+  }
+}
+
+uint64_t BonsaiDCW::get_count_(uint64_t pos) const {
+  return num_slots_ <= pos ? spill_counts_[pos - num_slots_] : counts_->get(pos);
+}
+
 } //bonsais
@@ -1,17 +1,26 @@
 #ifndef BONSAIS_BONSAI_DCW_HPP
 #define BONSAIS_BONSAI_DCW_HPP
 
+#include "BloomFilter.hpp"
+#include "CountVector.hpp"
 #include "FitVector.hpp"
+#include "PrefixCache.hpp"
+#include "WriteAheadLog.hpp"
 
 namespace bonsais {
 
 /*
  * Bonsai structure described in
  * - Darragh, Cleary and Witten, Bonsai: A compact representation of trees, SPE, 1993.
+ * A node whose collision group is saturated is spilled to a small table, in which the node is identified
+ * by its index with num_colls = colls_limit_, so that high load factors can be used with small colls_bits.
+ * The children of spilled nodes are also spilled, keyed by the index of the parent and the symbol,
+ * so that the hash function and the slots are kept as they are.
  * */
 class BonsaiDCW {
 public:
-  BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits);
+  BonsaiDCW(uint64_t num_slots, uint64_t alp_size, uint8_t colls_bits,
+          const VectorConfig& config = VectorConfig{});
   ~BonsaiDCW() {}
 
   static std::string name() { return "BonsaiDCW"; }
@@ -22,19 +31,81 @@ public:
   bool insert(const uint8_t* str, uint64_t len);
   template<typename T> bool insert(const T* str, uint64_t len);
 
-  uint64_t num_strs() const { return num_strs_; }
-  void show_stat(std::ostream& os) const;
-
-  BonsaiDCW(const BonsaiDCW&) = delete;
-  BonsaiDCW& operator=(const BonsaiDCW&) = delete;
+  // Sets whether each of num strings is stored to found, interleaving the walks to overlap cache misses.
+  void search_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num, bool* found) const;
+  // Returns whether a stored string starts with str.
+  bool contains_prefix(const uint8_t* str, uint64_t len) const;
 
-private:
   struct NodeID {
     uint64_t init_pos;
     uint64_t num_colls;
     uint64_t slot_pos; // for convenience
   };
 
+  // Node of a prefix, for matching a string byte by byte (e.g., from a stream) without walking from the root
+  // for each prefix. Insertions invalidate the slots of cursors.
+  using Cursor = NodeID;
+  Cursor root() const { return root_id_; }
+  // Moves cursor to its child by c and returns true, or returns false leaving it if not found.
+  bool child(Cursor& cursor, uint8_t c) const;
+  // Moves cursor by the bytes of str as far as found, and returns the number of bytes matched.
+  uint64_t advance(Cursor& cursor, const uint8_t* str, uint64_t len) const;
+  // Returns whether the prefix up to cursor is stored.
+  bool is_final(const Cursor& cursor) const { return get_fbit_(cursor.slot_pos); }
+
+  // Inserts num strings level by level in the order of their target slots,
+  // and returns the number of newly inserted strings.
+  uint64_t insert_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num);
+  template<typename T> uint64_t insert_all(const T* const* strs, const uint64_t* lens, uint64_t num);
+
+  uint64_t num_strs() const { return num_strs_; }
+  uint64_t num_nodes() const { return num_nodes_; }
+  uint64_t alp_size() const { return alp_size_; }
+  // whether strings of other than uint8_t were inserted
+  bool typed() const { return typed_; }
+  void show_stat(std::ostream& os) const;
+  // Returns the memory taken by each component, which show_stat() also reports.
+  MemoryUsage memory_usage() const;
+
+  // Appends all strings to keys in no particular order, decoding symbols of strings composed of uint8_t.
+  // Each string is restored from its final node by inverting the hash function up to the root.
+  void enumerate(std::vector<std::string>& keys, uint32_t num_threads = 1) const;
+
+  void save(std::ostream& os) const;
+  void load(std::istream& is);
+
+  // Enables a Bloom filter consulted before searching, for capacity strings with bits_per_key bits each.
+  // Strings already inserted are added to it by enumeration, so that all of them must be composed of uint8_t,
+  // and it is rebuilt in the same way for twice the strings once they exceed capacity. It is neither saved nor loaded.
+  void enable_filter(uint64_t capacity, uint8_t bits_per_key = 10);
+  const BloomFilter* filter() const { return filter_.get(); }
+
+  uint64_t num_spills() const { return spill_keys_.size(); }
+
+  // Enables a cache of num_entries prefixes of up to depth symbols, where search() and insert() jump to the node
+  // of the longest prefix cached. insert() fills the cache, and strings already inserted are added by enumeration
+  // if all of them are composed of uint8_t.
+  void enable_prefix_cache(uint8_t depth, uint64_t num_entries = 1U << 12);
+  const PrefixCache* prefix_cache() const { return cache_.get(); }
+
+  // Enables counters of width bits per node, incremented whenever a string ending at the node is inserted,
+  // which are saved and loaded together.
+  void enable_counts(uint8_t width = 4);
+  const CountVector* counts() const { return counts_.get(); }
+  // Returns how many times str has been inserted since enable_counts(), or 0 if not stored.
+  uint64_t count(const uint8_t* str, uint64_t len) const;
+  template<typename T> uint64_t count(const T* str, uint64_t len) const;
+
+  // inserting strings composed of uint8_t also appends them to the log, and those of other types are rejected
+  void attach_log(WriteAheadLog* log) { log_ = log; }
+
+  // Writes back the slots to the file given by VectorConfig, waiting for the writes if wait.
+  void sync(bool wait = true) const { slots_.sync(wait); }
+
+  BonsaiDCW(const BonsaiDCW&) = delete;
+  BonsaiDCW& operator=(const BonsaiDCW&) = delete;
+
+private:
   uint64_t num_strs_;
   uint64_t num_slots_;
   uint64_t num_nodes_;
@@ -49,22 +120,81 @@ private:
 
   FitVector slots_; // with quotient value, virgin bit, change bit, and final bit
 
+  // nodes of saturated collision groups and their descendants, whose slot_pos is num_slots_ + index
+  std::map<uint64_t, uint64_t> spill_map_; // from codes to indexes
+  std::map<uint64_t, uint64_t> spill_child_map_; // from parent indexes * alp_size_ + symbols to indexes
+  // quo * num_slots_ + init_pos of the slot each node would take, or parent index * alp_size_ + symbol if nested
+  std::vector<uint64_t> spill_keys_;
+  std::vector<bool> spill_nested_; // whether the parent is also spilled
+  std::vector<bool> spill_fbits_;
+  std::vector<uint64_t> spill_counts_; // if counts_ enabled
+
   const uint64_t quo_inv_mask_ = 7U;
-  const uint64_t vbit_inv_mask_ = ~(1U << 2);
-  const uint64_t cbit_inv_mask_ = ~(1U << 1);
-  const uint64_t fbit_inv_mask_ = ~1U;
+  const uint64_t vbit_inv_mask_ = ~(UINT64_C(1) << 2);
+  const uint64_t cbit_inv_mask_ = ~(UINT64_C(1) << 1);
+  const uint64_t fbit_inv_mask_ = ~UINT64_C(1);
 
   // used for strings composed of uint8_t
   std::array<uint8_t, 256> table_;
   uint8_t alp_count_ = 0;
+  bool typed_ = false; // whether strings of other than uint8_t were inserted, which enumerate() cannot restore
+
+  WriteAheadLog* log_ = nullptr;
+  std::unique_ptr<BloomFilter> filter_;
+  std::unique_ptr<CountVector> counts_; // of slots, moved with the nodes
+  std::unique_ptr<PrefixCache> cache_; // of (init_pos, num_colls) packed by init_pos * (colls_limit_ + 1) + num_colls
 
   HashValue hash_(const NodeID& node_id, uint64_t symbol) const;
+  NodeID get_parent_(const NodeID& node_id, uint64_t inverse, uint64_t& symbol) const;
+  std::vector<uint8_t> get_bytes_() const; // symbols to bytes
+  void index_groups_(FitVector& starts, FitVector& homes) const;
+
+  void grow_filter_();
+
+  // counts a false positive of the filter, and returns false
+  bool count_miss_() const {
+    if (filter_) {
+      filter_->count_false_positive();
+    }
+    return false;
+  }
+
+  // Returns the depth reached by the prefix cache, setting the node there and the tag of the prefix
+  // (that of the empty prefix if no prefix is cached, or 0 without the cache).
+  // The slot_pos of the node is left kNotFound since slots may have been displaced.
+  template<typename F>
+  uint64_t jump_(uint64_t len, F get_symbol, NodeID& node_id, uint64_t& tag) const {
+    tag = 0;
+    if (!cache_) {
+      return 0;
+    }
+    uint64_t node = 0;
+    const auto depth = cache_->find_longest(len, get_symbol, tag, node);
+    if (depth != 0) {
+      node_id = {node / (colls_limit_ + 1), node % (colls_limit_ + 1), kNotFound};
+    }
+    return depth;
+  }
+  void store_(uint64_t tag, const NodeID& node_id) {
+    cache_->store(tag, node_id.init_pos * (colls_limit_ + 1) + node_id.num_colls);
+  }
+
+  uint64_t get_code_(uint8_t c);
+
+  template<typename F> uint64_t insert_all_(const uint64_t* lens, uint64_t num, F get_symbol);
 
   bool get_child_(NodeID& node_id, uint64_t symbol) const;
+  void prefetch_child_(const NodeID& node_id, uint64_t symbol) const;
   bool add_child_(NodeID& node_id, uint64_t symbol);
+  bool add_child_(NodeID& node_id, const HashValue& hv);
+  bool spill_(NodeID& node_id, const HashValue& hv);
+  bool spill_child_(NodeID& node_id, uint64_t symbol);
+  NodeID append_spill_(uint64_t key, bool nested);
+  bool is_spilled_(const NodeID& node_id) const { return node_id.num_colls == colls_limit_; }
 
   uint64_t find_ass_cbit_pos_(uint64_t pos, uint64_t& empty_pos) const;
   uint64_t find_item_(uint64_t& pos, uint64_t quo) const;
+  uint64_t locate_(const NodeID& node_id) const;
 
   uint64_t right_(uint64_t pos) const;
   uint64_t left_(uint64_t pos) const;
@@ -81,28 +211,63 @@ private:
   void set_fbit_(uint64_t pos, bool bit);
 
   void update_slot_(uint64_t pos, uint64_t quo, bool vbit, bool cbit, bool fbit);
+
+  // both also take the slot_pos of spilled nodes
+  void increment_count_(uint64_t pos);
+  uint64_t get_count_(uint64_t pos) const;
 };
 
 template<typename T>
 bool BonsaiDCW::search(const T* str, uint64_t len) const {
   static_assert(Is_pod<T>(), "T is not POD.");
 
+  if (filter_ && filter_->rejects(str, len * sizeof(T))) {
+    return false;
+  }
+
   auto node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
     if (!get_child_(node_id, static_cast<uint64_t>(str[i]))) {
-      return false;
+      return count_miss_();
     }
   }
-  return get_fbit_(node_id.slot_pos);
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  return get_fbit_(node_id.slot_pos) || count_miss_();
 }
 
 template<typename T>
 bool BonsaiDCW::insert(const T* str, uint64_t len) {
   static_assert(Is_pod<T>(), "T is not POD.");
 
+  if (log_ != nullptr) { // the log is replayed through insert() of uint8_t
+    std::cerr << "ERROR: strings of " << sizeof(T) << "-byte symbols cannot be logged" << std::endl;
+    exit(1);
+  }
+  if (filter_) { // rebuilt by enumeration, which cannot restore them
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  typed_ = true;
+
   auto node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
     add_child_(node_id, static_cast<uint64_t>(str[i]));
+    if (tag != 0) {
+      tag = cache_->extend_tag(tag, static_cast<uint64_t>(str[i]));
+      store_(tag, node_id);
+    }
+  }
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  if (counts_) {
+    increment_count_(node_id.slot_pos);
   }
 
   if (get_fbit_(node_id.slot_pos)) {
@@ -114,6 +279,151 @@ bool BonsaiDCW::insert(const T* str, uint64_t len) {
   return true;
 }
 
+template<typename T>
+uint64_t BonsaiDCW::count(const T* str, uint64_t len) const {
+  static_assert(Is_pod<T>(), "T is not POD.");
+
+  auto node_id = root_id_;
+  uint64_t tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
+    if (!get_child_(node_id, static_cast<uint64_t>(str[i]))) {
+      return 0;
+    }
+  }
+  if (node_id.slot_pos == kNotFound) {
+    node_id.slot_pos = locate_(node_id);
+  }
+  if (!get_fbit_(node_id.slot_pos)) {
+    return 0;
+  }
+  return counts_ ? get_count_(node_id.slot_pos) : 1;
+}
+
+template<typename T>
+uint64_t BonsaiDCW::insert_all(const T* const* strs, const uint64_t* lens, uint64_t num) {
+  static_assert(Is_pod<T>(), "T is not POD.");
+
+  if (log_ != nullptr) { // the log is replayed through insert() of uint8_t
+    std::cerr << "ERROR: strings of " << sizeof(T) << "-byte symbols cannot be logged" << std::endl;
+    exit(1);
+  }
+  if (filter_) { // rebuilt by enumeration, which cannot restore them
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  typed_ = true;
+
+  return insert_all_(lens, num, [&](uint64_t i, uint64_t depth) {
+    return static_cast<uint64_t>(strs[i][depth]);
+  });
+}
+
+template<typename F>
+uint64_t BonsaiDCW::insert_all_(const uint64_t* lens, uint64_t num, F get_symbol) {
+  struct State {
+    uint64_t str_id;
+    NodeID node_id;
+  };
+  struct Request {
+    uint64_t key; // (hv.rem, hv.quo)
+    uint64_t state_id;
+  };
+
+  constexpr uint64_t kPrefetchDistance = 16;
+
+  const uint8_t quo_bits = num_bits(empty_mark_);
+  const uint64_t quo_mask = (UINT64_C(1) << quo_bits) - 1;
+  const uint8_t key_bits = num_bits(num_slots_ - 1) + quo_bits;
+
+  std::vector<NodeID> node_ids(num, root_id_); // of the ends
+  std::vector<State> states; // kept in the order of strings to read them sequentially
+  std::vector<Request> requests, buf;
+
+  for (uint64_t i = 0; i < num; ++i) {
+    if (lens[i] != 0) {
+      states.push_back({i, root_id_});
+    }
+  }
+
+  if (64 < key_bits) { // the keys of requests would overflow, so inserting the strings one by one
+    for (const auto& state : states) {
+      for (uint64_t depth = 0; depth < lens[state.str_id]; ++depth) {
+        add_child_(node_ids[state.str_id], get_symbol(state.str_id, depth));
+      }
+    }
+    states.clear();
+  }
+
+  for (uint64_t depth = 0; !states.empty(); ++depth) {
+    requests.clear();
+    for (uint64_t i = 0; i < states.size(); ++i) {
+      auto& state = states[i];
+      const auto symbol = get_symbol(state.str_id, depth);
+      if (is_spilled_(state.node_id)) { // not taking a slot
+        add_child_(state.node_id, symbol);
+        continue;
+      }
+      if (alp_size_ <= symbol) {
+        std::cerr << "ERROR: out-of-range symbol" << std::endl;
+        exit(1);
+      }
+      const auto hv = hash_(state.node_id, symbol);
+      if (empty_mark_ <= hv.quo) {
+        std::cerr << "ERROR: out-of-range hv.quo" << std::endl;
+        exit(1);
+      }
+      requests.push_back({(hv.rem << quo_bits) | hv.quo, i});
+    }
+
+    radix_sort(requests, buf, key_bits, [](const Request& r) { return r.key; });
+
+    // applying in the order of slots, where identical keys come from the same (parent, symbol) pair
+    for (uint64_t begin = 0, end = 0; begin < requests.size(); begin = end) {
+      if (begin + kPrefetchDistance < requests.size()) {
+        __builtin_prefetch(&states[requests[begin + kPrefetchDistance].state_id]);
+      }
+      const HashValue hv{requests[begin].key >> quo_bits, requests[begin].key & quo_mask};
+      auto node_id = states[requests[begin].state_id].node_id;
+      add_child_(node_id, hv);
+      for (end = begin; end < requests.size() && requests[end].key == requests[begin].key; ++end) {
+        auto& state = states[requests[end].state_id];
+        state.node_id = node_id;
+      }
+    }
+
+    uint64_t num_states = 0;
+    for (const auto& state : states) {
+      if (cache_ && depth < cache_->depth()) {
+        const auto tag = cache_->make_tag([&](uint64_t j) { return get_symbol(state.str_id, j); }, depth + 1);
+        store_(tag, state.node_id);
+      }
+      if (depth + 1 < lens[state.str_id]) {
+        states[num_states++] = state;
+      } else {
+        node_ids[state.str_id] = state.node_id;
+      }
+    }
+    states.resize(num_states);
+  }
+
+  // slot positions were changed by displacement after the nodes were reached
+  uint64_t ret = 0;
+  for (uint64_t i = 0; i < num; ++i) {
+    const auto pos = locate_(node_ids[i]);
+    if (counts_) {
+      increment_count_(pos);
+    }
+    if (!get_fbit_(pos)) {
+      set_fbit_(pos, true);
+      ++ret;
+    }
+  }
+  num_strs_ += ret;
+  grow_filter_();
+  return ret;
+}
+
 } //bonsais
 
 #endif //BONSAIS_BONSAI_DCW_HPP
@@ -1,8 +1,10 @@
 #include "BonsaiPR.hpp"
+#include "Merge.hpp"
 
 namespace bonsais {
 
-BonsaiPR::BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st) {
+BonsaiPR::BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st,
+                   const VectorConfig& config) {
   num_strs_ = 0;
 
   num_slots_ = num_slots;
@@ -12,10 +14,13 @@ BonsaiPR::BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st) {
 
   root_id_ = num_slots / 2; // without a particular reason
   empty_mark_ = alp_size + 2; // greater than the maximum quotient value expected
-  max_dsp1st_ = (1U << width_1st) - 1;
+  max_dsp1st_ = (UINT64_C(1) << width_1st) - 1;
 
-  prime_ = greater_prime(alp_size * num_slots + num_slots - 1);
-  multiplier_ = UINT64_MAX / prime_; // Todo: support invertible
+  prime_ = code_prime(static_cast<unsigned __int128>(alp_size) * num_slots + num_slots - 1);
+  multiplier_ = UINT64_MAX / prime_;
+  if (multiplier_ % prime_ == 0) { // keeping the hash function invertible
+    --multiplier_;
+  }
 
   if (num_bits(alp_size - 1) < num_bits(empty_mark_)) {
     std::cerr << "Note that #bits required for alp_size < #bits allocated" << std::endl;
@@ -24,35 +29,49 @@ BonsaiPR::BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st) {
   }
 
   FitVector(num_slots, num_bits(empty_mark_) + width_1st + 1U,
-            empty_mark_ << (width_1st + 1U)).swap(slots_);
+            empty_mark_ << (width_1st + 1U), config).swap(slots_);
   table_.fill(UINT8_MAX);
 }
 
 bool BonsaiPR::search(const uint8_t* str, uint64_t len) const {
-  uint64_t node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
+  if (filter_ && filter_->rejects(str, len)) {
+    return false;
+  }
+
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
     if (table_[str[i]] == UINT8_MAX) {
-      return false;
+      return count_miss_();
     }
     if (!get_child_(node_id, static_cast<uint64_t>(table_[str[i]]))) {
-      return false;
+      return count_miss_();
     }
   }
-  return get_fbit_(node_id);
+  return get_fbit_(node_id) || count_miss_();
 }
 
 bool BonsaiPR::insert(const uint8_t* str, uint64_t len) {
-  uint64_t node_id = root_id_;
+  if (log_ != nullptr) {
+    log_->append(str, len);
+  }
+  if (filter_) {
+    filter_->add(str, len);
+  }
+
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return get_code_(str[j]); }, node_id, tag);
   bool is_tail = false;
-  for (uint64_t i = 0; i < len; ++i) {
-    if (table_[str[i]] == UINT8_MAX) {
-      table_[str[i]] = alp_count_++;
-      if (alp_size_ <= alp_count_) {
-        std::cerr << "ERROR: alp_size_ < alp_count_" << std::endl;
-        exit(1);
-      }
+  for (; i < len; ++i) {
+    const auto symbol = get_code_(str[i]);
+    is_tail = add_child_(node_id, symbol, is_tail);
+    if (tag != 0) {
+      tag = cache_->extend_tag(tag, symbol);
+      cache_->store(tag, node_id);
     }
-    is_tail = add_child_(node_id, static_cast<uint64_t>(table_[str[i]]), is_tail);
+  }
+  if (counts_) {
+    counts_->increment(node_id);
   }
   if (get_fbit_(node_id)) {
     assert(!is_tail);
@@ -60,9 +79,103 @@ bool BonsaiPR::insert(const uint8_t* str, uint64_t len) {
   }
   set_fbit_(node_id, true);
   ++num_strs_;
+  grow_filter_();
   return true;
 }
 
+void BonsaiPR::search_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num, bool* found) const {
+  struct Walk {
+    uint64_t str_id;
+    uint64_t depth;
+    uint64_t node_id;
+  };
+
+  // prefetches the slot of the next child, or sets the result at the end
+  auto next = [&](Walk& walk) {
+    const auto str = strs[walk.str_id];
+    if (walk.depth == lens[walk.str_id]) {
+      found[walk.str_id] = get_fbit_(walk.node_id) || count_miss_();
+      return false;
+    }
+    if (table_[str[walk.depth]] == UINT8_MAX) {
+      found[walk.str_id] = count_miss_();
+      return false;
+    }
+    prefetch_child_(walk.node_id, table_[str[walk.depth]]);
+    return true;
+  };
+
+  interleave_walks<Walk>(num, [&](uint64_t i, Walk& walk) {
+    if (filter_ && filter_->rejects(strs[i], lens[i])) {
+      found[i] = false;
+      return false;
+    }
+    uint64_t tag = 0;
+    walk = {i, 0, root_id_};
+    walk.depth = jump_(lens[i], [&](uint64_t j) { return table_[strs[i][j]]; }, walk.node_id, tag);
+    return next(walk);
+  }, [&](Walk& walk) {
+    if (!get_child_(walk.node_id, table_[strs[walk.str_id][walk.depth]])) {
+      found[walk.str_id] = count_miss_();
+      return false;
+    }
+    ++walk.depth;
+    return next(walk);
+  });
+}
+
+uint64_t BonsaiPR::count(const uint8_t* str, uint64_t len) const {
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
+    if (table_[str[i]] == UINT8_MAX || !get_child_(node_id, table_[str[i]])) {
+      return 0;
+    }
+  }
+  if (!get_fbit_(node_id)) {
+    return 0;
+  }
+  return counts_ ? counts_->get(node_id) : 1;
+}
+
+bool BonsaiPR::contains_prefix(const uint8_t* str, uint64_t len) const {
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return table_[str[j]]; }, node_id, tag);
+  for (; i < len; ++i) {
+    if (table_[str[i]] == UINT8_MAX || !get_child_(node_id, table_[str[i]])) {
+      return false;
+    }
+  }
+  return num_strs_ != 0;
+}
+
+bool BonsaiPR::child(Cursor& cursor, uint8_t c) const {
+  return table_[c] != UINT8_MAX && get_child_(cursor.node_id, table_[c]);
+}
+
+uint64_t BonsaiPR::advance(Cursor& cursor, const uint8_t* str, uint64_t len) const {
+  uint64_t i = 0;
+  while (i < len && child(cursor, str[i])) {
+    ++i;
+  }
+  return i;
+}
+
+uint64_t BonsaiPR::insert_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num) {
+  for (uint64_t i = 0; i < num; ++i) {
+    if (log_ != nullptr) {
+      log_->append(strs[i], lens[i]);
+    }
+    if (filter_) {
+      filter_->add(strs[i], lens[i]);
+    }
+  }
+
+  return insert_all_(lens, num, [&](uint64_t i, uint64_t depth) {
+    return get_code_(strs[i][depth]);
+  });
+}
+
 void BonsaiPR::show_stat(std::ostream& os) const {
   os << "BonsaiPlus stat." << std::endl;
   os << "num slots:   " << num_slots_ << std::endl;
@@ -72,8 +185,169 @@ void BonsaiPR::show_stat(std::ostream& os) const {
   os << "auxs rate:   " << static_cast<double>(aux_map_.size()) / num_slots_ << std::endl;
   os << "alp size:    " << alp_size_ << std::endl;
   os << "width 1st:   " << (uint32_t) width_1st_ << std::endl;
+  os << "blocked:     " << slots_.blocked() << std::endl;
+  os << "page size:   " << slots_.page_size() << std::endl;
+  os << "file backed: " << slots_.file_backed() << std::endl;
+  if (filter_) {
+    os << "size filter: " << filter_->size_in_bytes() << std::endl;
+    os << "filter rejects: " << filter_->num_rejects() << std::endl;
+    os << "filter FP rate: " << filter_->false_positive_rate() << std::endl;
+  }
+  if (counts_) {
+    os << "size counts: " << counts_->size_in_bytes() << std::endl;
+    os << "count overflows: " << counts_->num_overflows() << std::endl;
+  }
+  if (cache_) {
+    os << "size cache:  " << cache_->size_in_bytes() << std::endl;
+    os << "cache hit rate: " << cache_->hit_rate() << std::endl;
+    os << "cache skipped depth: " << cache_->skipped_depth() << std::endl;
+  }
   os << "size slots:  " << slots_.size_in_bytes() << std::endl;
   os << "average dsp: " << calc_ave_dsp() << std::endl;
+  memory_usage().show(os, num_nodes_, num_strs_);
+}
+
+MemoryUsage BonsaiPR::memory_usage() const {
+  MemoryUsage ret;
+  ret.slots = slots_.allocated_bytes();
+  ret.auxs = map_bytes(aux_map_);
+  ret.filter = filter_ ? filter_->allocated_bytes() : 0;
+  ret.cache = cache_ ? cache_->allocated_bytes() : 0;
+  ret.counts = counts_ ? counts_->allocated_bytes() : 0;
+  ret.others = sizeof(*this);
+  return ret;
+}
+
+void BonsaiPR::enable_filter(uint64_t capacity, uint8_t bits_per_key) {
+  if (typed_) {
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  filter_.reset(new BloomFilter{capacity, bits_per_key});
+
+  std::vector<std::string> keys;
+  enumerate(keys, std::max(std::thread::hardware_concurrency(), 1U));
+  for (const auto& key : keys) {
+    filter_->add(key.data(), key.size());
+  }
+}
+
+// Rebuilds the filter for twice the strings once they exceed its capacity.
+void BonsaiPR::grow_filter_() {
+  if (filter_ && filter_->capacity() < num_strs_) {
+    enable_filter(std::max(2 * num_strs_, BloomFilter::kMinCapacity), filter_->bits_per_key());
+  }
+}
+
+void BonsaiPR::enable_counts(uint8_t width) {
+  counts_.reset(new CountVector{num_slots_, width});
+}
+
+void BonsaiPR::enable_prefix_cache(uint8_t depth, uint64_t num_entries) {
+  cache_.reset(new PrefixCache{depth, num_entries});
+  if (typed_) {
+    return; // not restored by enumeration
+  }
+
+  std::vector<std::string> keys;
+  enumerate(keys, std::max(std::thread::hardware_concurrency(), 1U));
+  for (const auto& key : keys) {
+    uint64_t node_id = root_id_, tag = PrefixCache::kEmptyTag;
+    for (uint64_t i = 0; i < key.size(); ++i) {
+      const uint64_t symbol = table_[static_cast<uint8_t>(key[i])];
+      if ((tag = cache_->extend_tag(tag, symbol)) == 0) {
+        break;
+      }
+      get_child_(node_id, symbol);
+      cache_->store(tag, node_id);
+    }
+  }
+}
+
+void BonsaiPR::save(std::ostream& os) const {
+  write_value(os, num_strs_);
+  write_value(os, num_slots_);
+  write_value(os, num_nodes_);
+  write_value(os, alp_size_);
+  write_value(os, width_1st_);
+  write_value(os, root_id_);
+  write_value(os, empty_mark_);
+  write_value(os, max_dsp1st_);
+  write_value(os, prime_);
+  write_value(os, multiplier_);
+  slots_.save(os);
+  write_value(os, static_cast<uint64_t>(aux_map_.size()));
+  for (const auto& aux : aux_map_) {
+    write_value(os, aux.first);
+    write_value(os, aux.second);
+  }
+  write_value(os, table_);
+  write_value(os, alp_count_);
+  write_value(os, typed_);
+  write_value(os, counts_ != nullptr);
+  if (counts_) {
+    counts_->save(os);
+  }
+}
+
+void BonsaiPR::load(std::istream& is) {
+  read_value(is, num_strs_);
+  read_value(is, num_slots_);
+  read_value(is, num_nodes_);
+  read_value(is, alp_size_);
+  read_value(is, width_1st_);
+  read_value(is, root_id_);
+  read_value(is, empty_mark_);
+  read_value(is, max_dsp1st_);
+  read_value(is, prime_);
+  read_value(is, multiplier_);
+  slots_.load(is);
+  uint64_t num_auxs = 0;
+  read_value(is, num_auxs);
+  aux_map_.clear();
+  for (uint64_t i = 0; i < num_auxs; ++i) {
+    std::pair<uint64_t, uint32_t> aux;
+    read_value(is, aux.first);
+    read_value(is, aux.second);
+    aux_map_.insert(aux_map_.end(), aux);
+  }
+  read_value(is, table_);
+  read_value(is, alp_count_);
+  read_value(is, typed_);
+  bool has_counts = false;
+  read_value(is, has_counts);
+  counts_.reset(has_counts ? new CountVector : nullptr);
+  if (counts_) {
+    counts_->load(is);
+  }
+  filter_.reset(); // not covering the loaded strings
+  cache_.reset();
+
+  if (!is) {
+    std::cerr << "ERROR: failed to load " << name() << std::endl;
+    exit(1);
+  }
+}
+
+void BonsaiPR::enumerate(std::vector<std::string>& keys, uint32_t num_threads) const {
+  const auto inverse = pow_mod(multiplier_ % prime_, prime_ - 2, prime_); // multiplier_ is coprime to prime_
+  const auto bytes = get_bytes_();
+
+  if (get_fbit_(root_id_)) {
+    keys.emplace_back();
+  }
+
+  walk_up_keys<uint64_t>(num_slots_, num_threads, [&](uint64_t pos, uint64_t& node_id) {
+    node_id = pos;
+    return pos != root_id_ && get_quo_(pos) != empty_mark_ && get_fbit_(pos);
+  }, [&](uint64_t& node_id) {
+    uint64_t symbol = 0;
+    node_id = get_parent_(node_id, inverse, symbol);
+    slots_.prefetch(node_id);
+    return static_cast<int>(bytes[symbol]);
+  }, [&](uint64_t node_id) {
+    return node_id == root_id_;
+  }, keys);
 }
 
 double BonsaiPR::calc_ave_dsp() const {
@@ -89,11 +363,35 @@ double BonsaiPR::calc_ave_dsp() const {
 
 // expecting 0 <= quo <= alp_size + 1
 HashValue BonsaiPR::hash_(uint64_t node_id, uint64_t symbol) const {
+  // c < prime_ and multiplier_ <= UINT64_MAX / prime_, so the product fits in 64 bits
   uint64_t c = symbol * num_slots_ + node_id;
   uint64_t c_rnd = ((c % prime_) * multiplier_) % prime_; // avoiding overflow
   return {c_rnd % num_slots_, c_rnd / num_slots_};
 }
 
+// Returns the parent of the node at 'pos' and sets the symbol on the edge to it,
+// where 'inverse' is that of multiplier_ modulo prime_.
+uint64_t BonsaiPR::get_parent_(uint64_t pos, uint64_t inverse, uint64_t& symbol) const {
+  // skipping root_id_ is also counted in the displacement
+  const uint64_t rem = (pos + num_slots_ - get_dsp_(pos)) % num_slots_;
+  const uint64_t c = mul_mod(get_quo_(pos) * num_slots_ + rem, inverse, prime_);
+  symbol = c / num_slots_;
+  return c % num_slots_;
+}
+
+std::vector<uint8_t> BonsaiPR::get_bytes_() const {
+  std::vector<uint8_t> bytes(alp_size_);
+  for (uint64_t i = 0; i < alp_size_; ++i) {
+    bytes[i] = static_cast<uint8_t>(i);
+  }
+  for (uint64_t c = 0; c < table_.size(); ++c) {
+    if (table_[c] != UINT8_MAX) {
+      bytes[table_[c]] = static_cast<uint8_t>(c);
+    }
+  }
+  return bytes;
+}
+
 bool BonsaiPR::get_child_(uint64_t& node_id, uint64_t symbol) const {
   if (alp_size_ <= symbol) {
     std::cerr << "ERROR: out-of-range symbol" << std::endl;
@@ -124,6 +422,12 @@ bool BonsaiPR::get_child_(uint64_t& node_id, uint64_t symbol) const {
   }
 }
 
+void BonsaiPR::prefetch_child_(uint64_t node_id, uint64_t symbol) const {
+  const auto pos = hash_(node_id, symbol).rem;
+  slots_.prefetch(pos);
+  slots_.will_need(pos);
+}
+
 bool BonsaiPR::add_child_(uint64_t& node_id, uint64_t symbol, bool is_tail) {
   if (alp_size_ <= symbol) {
     std::cerr << "ERROR: out-of-range symbol" << std::endl;
@@ -136,6 +440,10 @@ bool BonsaiPR::add_child_(uint64_t& node_id, uint64_t symbol, bool is_tail) {
     exit(1);
   }
 
+  return add_child_(node_id, hv, is_tail);
+}
+
+bool BonsaiPR::add_child_(uint64_t& node_id, const HashValue& hv, bool is_tail) {
   for (uint64_t pos = hv.rem, cnt = 0;; pos = right_(pos), ++cnt) {
     if (pos == root_id_) {
       continue;
@@ -161,6 +469,18 @@ bool BonsaiPR::add_child_(uint64_t& node_id, uint64_t symbol, bool is_tail) {
   }
 }
 
+// Returns the code of c, assigning a new one if not registered.
+uint64_t BonsaiPR::get_code_(uint8_t c) {
+  if (table_[c] == UINT8_MAX) {
+    table_[c] = alp_count_++;
+    if (alp_size_ <= alp_count_) {
+      std::cerr << "ERROR: alp_size_ < alp_count_" << std::endl;
+      exit(1);
+    }
+  }
+  return table_[c];
+}
+
 uint64_t BonsaiPR::right_(uint64_t pos) const {
   return ++pos >= num_slots_ ? 0 : pos;
 }
@@ -183,7 +503,7 @@ bool BonsaiPR::get_fbit_(uint64_t pos) const {
 }
 
 void BonsaiPR::set_fbit_(uint64_t pos, bool bit) {
-  slots_.set(pos, (slots_.get(pos) & ~1U) | bit);
+  slots_.set(pos, (slots_.get(pos) & ~UINT64_C(1)) | bit);
 }
 
 void BonsaiPR::update_slot_(uint64_t pos, uint64_t quo, uint64_t dsp, bool fbit) {
@@ -1,7 +1,11 @@
 #ifndef BONSAIS_BONSAI_PR_HPP
 #define BONSAIS_BONSAI_PR_HPP
 
+#include "BloomFilter.hpp"
+#include "CountVector.hpp"
 #include "FitVector.hpp"
+#include "PrefixCache.hpp"
+#include "WriteAheadLog.hpp"
 
 namespace bonsais {
 
@@ -11,7 +15,8 @@ namespace bonsais {
  * */
 class BonsaiPR {
 public:
-  BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st);
+  BonsaiPR(uint64_t num_slots, uint64_t alp_size, uint8_t width_1st,
+         const VectorConfig& config = VectorConfig{});
   ~BonsaiPR() {}
 
   static std::string name() { return "BonsaiPR"; }
@@ -22,8 +27,70 @@ public:
   bool insert(const uint8_t* str, uint64_t len);
   template<typename T> bool insert(const T* str, uint64_t len);
 
+  // Sets whether each of num strings is stored to found, interleaving the walks to overlap cache misses.
+  void search_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num, bool* found) const;
+  // Returns whether a stored string starts with str.
+  bool contains_prefix(const uint8_t* str, uint64_t len) const;
+
+  // Node of a prefix, for matching a string byte by byte (e.g., from a stream) without walking from the root
+  // for each prefix.
+  struct Cursor {
+    uint64_t node_id;
+  };
+  Cursor root() const { return {root_id_}; }
+  // Moves cursor to its child by c and returns true, or returns false leaving it if not found.
+  bool child(Cursor& cursor, uint8_t c) const;
+  // Moves cursor by the bytes of str as far as found, and returns the number of bytes matched.
+  uint64_t advance(Cursor& cursor, const uint8_t* str, uint64_t len) const;
+  // Returns whether the prefix up to cursor is stored.
+  bool is_final(const Cursor& cursor) const { return get_fbit_(cursor.node_id); }
+
+  // Inserts num strings level by level in the order of their target slots,
+  // and returns the number of newly inserted strings.
+  uint64_t insert_all(const uint8_t* const* strs, const uint64_t* lens, uint64_t num);
+  template<typename T> uint64_t insert_all(const T* const* strs, const uint64_t* lens, uint64_t num);
+
   uint64_t num_strs() const { return num_strs_; }
+  uint64_t num_nodes() const { return num_nodes_; }
+  uint64_t alp_size() const { return alp_size_; }
+  // whether strings of other than uint8_t were inserted
+  bool typed() const { return typed_; }
   void show_stat(std::ostream& os) const;
+  // Returns the memory taken by each component, which show_stat() also reports.
+  MemoryUsage memory_usage() const;
+
+  // Appends all strings to keys in no particular order, decoding symbols of strings composed of uint8_t.
+  // Each string is restored from its final node by inverting the hash function up to the root.
+  void enumerate(std::vector<std::string>& keys, uint32_t num_threads = 1) const;
+
+  void save(std::ostream& os) const;
+  void load(std::istream& is);
+
+  // Enables a Bloom filter consulted before searching, for capacity strings with bits_per_key bits each.
+  // Strings already inserted are added to it by enumeration, so that all of them must be composed of uint8_t,
+  // and it is rebuilt in the same way for twice the strings once they exceed capacity. It is neither saved nor loaded.
+  void enable_filter(uint64_t capacity, uint8_t bits_per_key = 10);
+  const BloomFilter* filter() const { return filter_.get(); }
+
+  // Enables a cache of num_entries prefixes of up to depth symbols, where search() and insert() jump to the node
+  // of the longest prefix cached. insert() fills the cache, and strings already inserted are added by enumeration
+  // if all of them are composed of uint8_t.
+  void enable_prefix_cache(uint8_t depth, uint64_t num_entries = 1U << 12);
+  const PrefixCache* prefix_cache() const { return cache_.get(); }
+
+  // Enables counters of width bits per node, incremented whenever a string ending at the node is inserted,
+  // which are saved and loaded together.
+  void enable_counts(uint8_t width = 4);
+  const CountVector* counts() const { return counts_.get(); }
+  // Returns how many times str has been inserted since enable_counts(), or 0 if not stored.
+  uint64_t count(const uint8_t* str, uint64_t len) const;
+  template<typename T> uint64_t count(const T* str, uint64_t len) const;
+
+  // inserting strings composed of uint8_t also appends them to the log, and those of other types are rejected
+  void attach_log(WriteAheadLog* log) { log_ = log; }
+
+  // Writes back the slots to the file given by VectorConfig, waiting for the writes if wait.
+  void sync(bool wait = true) const { slots_.sync(wait); }
 
   double calc_ave_dsp() const;
 
@@ -50,11 +117,43 @@ private:
   // used for strings composed of uint8_t
   std::array<uint8_t, 256> table_;
   uint8_t alp_count_ = 0;
+  bool typed_ = false; // whether strings of other than uint8_t were inserted, which enumerate() cannot restore
+
+  WriteAheadLog* log_ = nullptr;
+  std::unique_ptr<BloomFilter> filter_;
+  std::unique_ptr<PrefixCache> cache_; // of node IDs
+  std::unique_ptr<CountVector> counts_; // of node IDs
 
   HashValue hash_(uint64_t node_id, uint64_t symbol) const;
+  uint64_t get_parent_(uint64_t pos, uint64_t inverse, uint64_t& symbol) const;
+  std::vector<uint8_t> get_bytes_() const; // symbols to bytes
+
+  void grow_filter_();
+
+  // counts a false positive of the filter, and returns false
+  bool count_miss_() const {
+    if (filter_) {
+      filter_->count_false_positive();
+    }
+    return false;
+  }
+
+  // Returns the depth reached by the prefix cache, setting the node there and the tag of the prefix
+  // (that of the empty prefix if no prefix is cached, or 0 without the cache).
+  template<typename F>
+  uint64_t jump_(uint64_t len, F get_symbol, uint64_t& node_id, uint64_t& tag) const {
+    tag = 0;
+    return cache_ ? cache_->find_longest(len, get_symbol, tag, node_id) : 0;
+  }
+
+  uint64_t get_code_(uint8_t c);
+
+  template<typename F> uint64_t insert_all_(const uint64_t* lens, uint64_t num, F get_symbol);
 
   bool get_child_(uint64_t& node_id, uint64_t symbol) const;
+  void prefetch_child_(uint64_t node_id, uint64_t symbol) const;
   bool add_child_(uint64_t& node_id, uint64_t symbol, bool is_tail = false);
+  bool add_child_(uint64_t& node_id, const HashValue& hv, bool is_tail);
 
   uint64_t right_(uint64_t pos) const;
 
@@ -70,23 +169,46 @@ template<typename T>
 bool BonsaiPR::search(const T* str, uint64_t len) const {
   static_assert(Is_pod<T>(), "T is not POD.");
 
-  uint64_t node_id = root_id_;
-  for (uint64_t i = 0; i < len; ++i) {
+  if (filter_ && filter_->rejects(str, len * sizeof(T))) {
+    return false;
+  }
+
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
     if (!get_child_(node_id, static_cast<uint64_t>(str[i]))) {
-      return false;
+      return count_miss_();
     }
   }
-  return get_fbit_(node_id);
+  return get_fbit_(node_id) || count_miss_();
 }
 
 template<typename T>
 bool BonsaiPR::insert(const T* str, uint64_t len) {
   static_assert(Is_pod<T>(), "T is not POD.");
 
-  uint64_t node_id = root_id_;
+  if (log_ != nullptr) { // the log is replayed through insert() of uint8_t
+    std::cerr << "ERROR: strings of " << sizeof(T) << "-byte symbols cannot be logged" << std::endl;
+    exit(1);
+  }
+  if (filter_) { // rebuilt by enumeration, which cannot restore them
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  typed_ = true;
+
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
   bool is_tail = false;
-  for (uint64_t i = 0; i < len; ++i) {
+  for (; i < len; ++i) {
     is_tail = add_child_(node_id, static_cast<uint64_t>(str[i]), is_tail);
+    if (tag != 0) {
+      tag = cache_->extend_tag(tag, static_cast<uint64_t>(str[i]));
+      cache_->store(tag, node_id);
+    }
+  }
+  if (counts_) {
+    counts_->increment(node_id);
   }
   if (get_fbit_(node_id)) {
     assert(!is_tail);
@@ -97,6 +219,145 @@ bool BonsaiPR::insert(const T* str, uint64_t len) {
   return true;
 }
 
+template<typename T>
+uint64_t BonsaiPR::count(const T* str, uint64_t len) const {
+  static_assert(Is_pod<T>(), "T is not POD.");
+
+  uint64_t node_id = root_id_, tag = 0;
+  auto i = jump_(len, [&](uint64_t j) { return static_cast<uint64_t>(str[j]); }, node_id, tag);
+  for (; i < len; ++i) {
+    if (!get_child_(node_id, static_cast<uint64_t>(str[i]))) {
+      return 0;
+    }
+  }
+  if (!get_fbit_(node_id)) {
+    return 0;
+  }
+  return counts_ ? counts_->get(node_id) : 1;
+}
+
+template<typename T>
+uint64_t BonsaiPR::insert_all(const T* const* strs, const uint64_t* lens, uint64_t num) {
+  static_assert(Is_pod<T>(), "T is not POD.");
+
+  if (log_ != nullptr) { // the log is replayed through insert() of uint8_t
+    std::cerr << "ERROR: strings of " << sizeof(T) << "-byte symbols cannot be logged" << std::endl;
+    exit(1);
+  }
+  if (filter_) { // rebuilt by enumeration, which cannot restore them
+    std::cerr << "ERROR: strings of other than uint8_t cannot be added to the filter" << std::endl;
+    exit(1);
+  }
+  typed_ = true;
+
+  return insert_all_(lens, num, [&](uint64_t i, uint64_t depth) {
+    return static_cast<uint64_t>(strs[i][depth]);
+  });
+}
+
+template<typename F>
+uint64_t BonsaiPR::insert_all_(const uint64_t* lens, uint64_t num, F get_symbol) {
+  struct State {
+    uint64_t str_id;
+    uint64_t node_id;
+    bool is_tail;
+  };
+  struct Request {
+    uint64_t key; // (hv.rem, hv.quo)
+    uint64_t state_id;
+  };
+
+  constexpr uint64_t kPrefetchDistance = 16;
+
+  const uint8_t quo_bits = num_bits(empty_mark_);
+  const uint64_t quo_mask = (UINT64_C(1) << quo_bits) - 1;
+  const uint8_t key_bits = num_bits(num_slots_ - 1) + quo_bits;
+
+  std::vector<uint64_t> node_ids(num, root_id_); // of the ends
+  std::vector<State> states; // kept in the order of strings to read them sequentially
+  std::vector<Request> requests, buf;
+
+  for (uint64_t i = 0; i < num; ++i) {
+    if (lens[i] != 0) {
+      states.push_back({i, root_id_, false});
+    }
+  }
+
+  if (64 < key_bits) { // the keys of requests would overflow, so inserting the strings one by one
+    for (const auto& state : states) {
+      bool is_tail = false;
+      for (uint64_t depth = 0; depth < lens[state.str_id]; ++depth) {
+        is_tail = add_child_(node_ids[state.str_id], get_symbol(state.str_id, depth), is_tail);
+      }
+    }
+    states.clear();
+  }
+
+  for (uint64_t depth = 0; !states.empty(); ++depth) {
+    requests.resize(states.size());
+    for (uint64_t i = 0; i < states.size(); ++i) {
+      const auto& state = states[i];
+      const auto symbol = get_symbol(state.str_id, depth);
+      if (alp_size_ <= symbol) {
+        std::cerr << "ERROR: out-of-range symbol" << std::endl;
+        exit(1);
+      }
+      const auto hv = hash_(state.node_id, symbol);
+      if (empty_mark_ <= hv.quo) {
+        std::cerr << "ERROR: out-of-range hv.quo" << std::endl;
+        exit(1);
+      }
+      requests[i] = {(hv.rem << quo_bits) | hv.quo, i};
+    }
+
+    radix_sort(requests, buf, key_bits, [](const Request& r) { return r.key; });
+
+    // applying in the order of slots, where identical keys come from the same (parent, symbol) pair
+    for (uint64_t begin = 0, end = 0; begin < requests.size(); begin = end) {
+      if (begin + kPrefetchDistance < requests.size()) {
+        __builtin_prefetch(&states[requests[begin + kPrefetchDistance].state_id]);
+      }
+      const auto& first = states[requests[begin].state_id];
+      const HashValue hv{requests[begin].key >> quo_bits, requests[begin].key & quo_mask};
+      auto node_id = first.node_id;
+      const bool is_tail = add_child_(node_id, hv, first.is_tail);
+      for (end = begin; end < requests.size() && requests[end].key == requests[begin].key; ++end) {
+        auto& state = states[requests[end].state_id];
+        state.node_id = node_id;
+        state.is_tail = is_tail;
+      }
+    }
+
+    uint64_t num_states = 0;
+    for (const auto& state : states) {
+      if (cache_ && depth < cache_->depth()) {
+        const auto tag = cache_->make_tag([&](uint64_t j) { return get_symbol(state.str_id, j); }, depth + 1);
+        cache_->store(tag, state.node_id);
+      }
+      if (depth + 1 < lens[state.str_id]) {
+        states[num_states++] = state;
+      } else {
+        node_ids[state.str_id] = state.node_id;
+      }
+    }
+    states.resize(num_states);
+  }
+
+  uint64_t ret = 0;
+  for (uint64_t i = 0; i < num; ++i) {
+    if (counts_) {
+      counts_->increment(node_ids[i]);
+    }
+    if (!get_fbit_(node_ids[i])) {
+      set_fbit_(node_ids[i], true);
+      ++ret;
+    }
+  }
+  num_strs_ += ret;
+  grow_filter_();
+  return ret;
+}
+
 } //bonsais
 
 #endif //BONSAIS_BONSAI_PR_HPP
@@ -0,0 +1,329 @@
+#ifndef BONSAIS_CHUNK_BUFFER_HPP
+#define BONSAIS_CHUNK_BUFFER_HPP
+
+#include <cstring>
+#include <fstream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Basics.hpp"
+
+namespace bonsais {
+
+enum class PageType {
+  normal, // heap memory
+  transparent, // mmap with madvise(MADV_HUGEPAGE)
+  huge_2m, // mmap with MAP_HUGETLB, falling back to transparent
+  huge_1g // mmap with MAP_HUGETLB, falling back to huge_2m
+};
+
+enum class NumaPolicy {
+  none, interleave, local
+};
+
+struct VectorConfig {
+  // line-aligned packing: elements are packed into 64-byte lines so that no element straddles a cache line
+  bool blocked = false;
+  PageType pages = PageType::normal;
+  NumaPolicy numa = NumaPolicy::none;
+  // maps the chunks to this file with shared pages, so that they can exceed the memory;
+  // the file is scratch space for one process, truncated when mapped and never reopened (use save() to keep a trie)
+  const char* file = nullptr;
+};
+
+/*
+ * Zero-initialized array of 64-bit chunks aligned to a cache line,
+ * allocated on the pages and NUMA nodes requested by VectorConfig, or mapped to its file.
+ * */
+class ChunkBuffer {
+public:
+  static constexpr uint64_t kAlignment = 64;
+  static constexpr uint64_t kSmallPageSize = 1U << 12;
+  static constexpr uint64_t kHugePageSize = 1U << 21;
+  static constexpr uint64_t kGiantPageSize = 1U << 30;
+
+  ChunkBuffer() {}
+
+  ChunkBuffer(uint64_t size, const VectorConfig& config) {
+    size_ = size;
+    const auto num_bytes = size * sizeof(uint64_t);
+
+#ifdef __linux__
+    if (config.file != nullptr) {
+      if (config.pages != PageType::normal || config.numa != NumaPolicy::none) {
+        std::cerr << "Note: ignoring the page type and NUMA policy for " << config.file << std::endl;
+      }
+      map_file_(num_bytes, config.file);
+      return;
+    }
+    if (config.pages != PageType::normal || config.numa != NumaPolicy::none) {
+      switch (config.pages) {
+        case PageType::huge_1g:
+          if (map_hugetlb_(num_bytes, kGiantPageSize, 30)) {
+            break;
+          }
+          std::cerr << "Note: failed to map 1 GiB pages" << std::endl;
+          // fall through
+        case PageType::huge_2m:
+          if (map_hugetlb_(num_bytes, kHugePageSize, 21)) {
+            break;
+          }
+          std::cerr << "Note: failed to map 2 MiB pages" << std::endl;
+          // fall through
+        case PageType::transparent:
+          map_(num_bytes, kHugePageSize);
+          ::madvise(data_, mapped_size_, MADV_HUGEPAGE);
+          is_transparent_ = true;
+          break;
+        case PageType::normal:
+          map_(num_bytes, kSmallPageSize);
+          break;
+      }
+      bind_(config.numa);
+      return;
+    }
+#else
+    if (config.file != nullptr) {
+      std::cerr << "ERROR: file-backed vectors are not supported" << std::endl;
+      exit(1);
+    }
+#endif
+
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, kAlignment, std::max<uint64_t>(num_bytes, kAlignment)) != 0) {
+      std::cerr << "ERROR: failed to allocate " << num_bytes << " bytes" << std::endl;
+      exit(1);
+    }
+    std::memset(ptr, 0, num_bytes);
+    data_ = static_cast<uint64_t*>(ptr);
+    page_size_ = kSmallPageSize;
+  }
+
+  ~ChunkBuffer() {
+    release_();
+  }
+
+  uint64_t* data() { return data_; }
+  const uint64_t* data() const { return data_; }
+  uint64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  uint64_t& operator[](uint64_t i) { return data_[i]; }
+  const uint64_t& operator[](uint64_t i) const { return data_[i]; }
+
+  // Size of the pages actually backing the buffer. For transparent huge pages,
+  // reports 2 MiB only if the kernel backed at least half of the buffer with them.
+  uint64_t page_size() const {
+    if (!is_transparent_) {
+      return page_size_;
+    }
+    return mapped_size_ <= 2 * smaps_bytes_("AnonHugePages") ? kHugePageSize : kSmallPageSize;
+  }
+
+  bool file_backed() const { return is_shared_; }
+
+  // including the rounding up to pages, or allocator overhead and alignment slack on the heap.
+  // For a file, only its pages resident in the process are counted.
+  uint64_t allocated_bytes() const {
+    if (data_ == nullptr) {
+      return 0;
+    }
+    if (is_shared_) {
+      return smaps_bytes_("Rss");
+    }
+    if (mapped_size_ != 0) {
+      return mapped_size_;
+    }
+    return heap_bytes(std::max<uint64_t>(size_ * sizeof(uint64_t), kAlignment)) + kAlignment;
+  }
+
+  // Writes back the dirty pages of the file, waiting for the writes if wait.
+  void sync(bool wait = true) const {
+#ifdef __linux__
+    if (is_shared_ && ::msync(data_, mapped_size_, wait ? MS_SYNC : MS_ASYNC) != 0) {
+      std::cerr << "ERROR: failed to sync the mapped file" << std::endl;
+      exit(1);
+    }
+#endif
+  }
+
+  // whether will_need() hints the kernel, i.e., the file may not stay in memory
+  bool hinted() const { return is_hinted_; }
+
+  // Starts reading the page of the i-th chunk of the file, if not resident.
+  void will_need(uint64_t i) const {
+#ifdef __linux__
+    if (is_hinted_) {
+      const auto addr = reinterpret_cast<uintptr_t>(data_ + i) & ~(kSmallPageSize - 1);
+      ::madvise(reinterpret_cast<void*>(addr), kSmallPageSize, MADV_WILLNEED);
+    }
+#endif
+  }
+
+  void swap(ChunkBuffer& rhs) {
+    std::swap(data_, rhs.data_);
+    std::swap(size_, rhs.size_);
+    std::swap(mapped_size_, rhs.mapped_size_);
+    std::swap(page_size_, rhs.page_size_);
+    std::swap(is_transparent_, rhs.is_transparent_);
+    std::swap(is_shared_, rhs.is_shared_);
+    std::swap(is_hinted_, rhs.is_hinted_);
+  }
+
+  ChunkBuffer(const ChunkBuffer&) = delete;
+  ChunkBuffer& operator=(const ChunkBuffer&) = delete;
+
+private:
+  uint64_t* data_ = nullptr;
+  uint64_t size_ = 0;
+  uint64_t mapped_size_ = 0; // 0 if allocated on the heap
+  uint64_t page_size_ = 0;
+  bool is_transparent_ = false;
+  bool is_shared_ = false; // mapped to a file
+  bool is_hinted_ = false; // larger than half the memory
+
+  void release_() {
+#ifdef __linux__
+    if (mapped_size_ != 0) {
+      ::munmap(data_, mapped_size_);
+      data_ = nullptr;
+      return;
+    }
+#endif
+    std::free(data_);
+    data_ = nullptr;
+  }
+
+#ifdef __linux__
+  static uint64_t round_up_(uint64_t n, uint64_t unit) {
+    return (std::max<uint64_t>(n, 1) + unit - 1) / unit * unit;
+  }
+
+  bool map_hugetlb_(uint64_t num_bytes, uint64_t page_size, int page_shift) {
+    const auto size = round_up_(num_bytes, page_size);
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+    if (ptr == MAP_FAILED) {
+      return false;
+    }
+    data_ = static_cast<uint64_t*>(ptr);
+    mapped_size_ = size;
+    page_size_ = page_size;
+    return true;
+  }
+
+  // Maps anonymous memory aligned to 'alignment', trimming the excess.
+  void map_(uint64_t num_bytes, uint64_t alignment) {
+    const auto size = round_up_(num_bytes, alignment);
+    const auto extra = alignment == kSmallPageSize ? 0 : alignment;
+    void* ptr = ::mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      std::cerr << "ERROR: failed to map " << num_bytes << " bytes" << std::endl;
+      exit(1);
+    }
+    auto begin = reinterpret_cast<uintptr_t>(ptr);
+    auto aligned = round_up_(begin, alignment);
+    if (extra != 0) {
+      if (begin < aligned) {
+        ::munmap(ptr, aligned - begin);
+      }
+      if (aligned + size < begin + size + extra) {
+        ::munmap(reinterpret_cast<void*>(aligned + size), begin + extra - aligned);
+      }
+    }
+    data_ = reinterpret_cast<uint64_t*>(aligned);
+    mapped_size_ = size;
+    page_size_ = kSmallPageSize;
+  }
+
+  // Maps a file truncated to num_bytes, whose pages are read on demand and written back by the kernel.
+  // Any previous content is discarded, since the metadata of the trie is not kept in the file.
+  // Random accesses are advised so that faults do not read ahead neighboring pages.
+  void map_file_(uint64_t num_bytes, const char* file) {
+    const auto size = round_up_(num_bytes, kSmallPageSize);
+    const int fd = ::open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      std::cerr << "ERROR: failed to create " << file << std::endl;
+      exit(1);
+    }
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file
+    if (ptr == MAP_FAILED) {
+      std::cerr << "ERROR: failed to map " << file << std::endl;
+      exit(1);
+    }
+    ::madvise(ptr, size, MADV_RANDOM);
+    data_ = static_cast<uint64_t*>(ptr);
+    mapped_size_ = size;
+    page_size_ = kSmallPageSize;
+    is_shared_ = true;
+    // hints cost a system call each, so are issued only if pages are likely to be evicted
+    is_hinted_ = memory_limit_() / 2 < size;
+  }
+
+  // Returns the physical memory, or the limit of the cgroup (v2 or v1) if smaller.
+  static uint64_t memory_limit_() {
+    auto ret = static_cast<uint64_t>(::sysconf(_SC_PHYS_PAGES)) * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    for (const char* file : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"}) {
+      std::ifstream ifs{file};
+      uint64_t limit = 0;
+      if (ifs >> limit) { // not "max"
+        ret = std::min(ret, limit);
+      }
+    }
+    return ret;
+  }
+
+  // Sets the NUMA policy before the pages are touched.
+  void bind_(NumaPolicy numa) {
+    constexpr int kMpolPreferred = 1;
+    constexpr int kMpolInterleave = 3;
+
+    if (numa == NumaPolicy::none) {
+      return;
+    }
+    // the kernel masks out nodes that are not allowed
+    uint64_t node_mask = numa == NumaPolicy::interleave ? UINT64_MAX : 0;
+    int mode = numa == NumaPolicy::interleave ? kMpolInterleave : kMpolPreferred;
+    if (::syscall(SYS_mbind, data_, mapped_size_, mode, &node_mask, 64, 0) != 0) {
+      std::cerr << "Note: failed to set the NUMA policy" << std::endl;
+    }
+  }
+
+  // Sums the field (e.g., "Rss") of /proc/self/smaps over the mappings of the buffer.
+  uint64_t smaps_bytes_(const char* field) const {
+    std::ifstream ifs{"/proc/self/smaps"};
+    const auto addr = reinterpret_cast<uintptr_t>(data_);
+    const auto format = std::string{field} + ": %lu kB";
+
+    std::string line;
+    bool in_range = false;
+    uint64_t ret = 0;
+    while (std::getline(ifs, line)) {
+      uintptr_t begin = 0, end = 0;
+      if (std::sscanf(line.c_str(), "%lx-%lx ", &begin, &end) == 2 && line.find(':') > line.find(' ')) {
+        in_range = addr <= begin && end <= addr + mapped_size_;
+        continue;
+      }
+      uint64_t kib = 0;
+      if (in_range && std::sscanf(line.c_str(), format.c_str(), &kib) == 1) {
+        ret += kib << 10;
+      }
+    }
+    return ret;
+  }
+#else
+  uint64_t smaps_bytes_(const char*) const {
+    return 0;
+  }
+#endif
+};
+
+} //bonsais
+
+#endif //BONSAIS_CHUNK_BUFFER_HPP
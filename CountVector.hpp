@@ -0,0 +1,106 @@
+#ifndef BONSAIS_COUNT_VECTOR_HPP
+#define BONSAIS_COUNT_VECTOR_HPP
+
+#include "FitVector.hpp"
+
+namespace bonsais {
+
+/*
+ * Counters of a few bits per slot, where saturated counters keep their values in an overflow map
+ * in the same manner as exceeding displacement values of BonsaiPR.
+ * */
+class CountVector {
+public:
+  CountVector() {}
+
+  CountVector(uint64_t length, uint8_t width, const VectorConfig& config = VectorConfig{}) {
+    FitVector(length, width, 0, config).swap(counts_);
+    max_ = width == 64 ? UINT64_MAX : (UINT64_C(1) << width) - 1;
+  }
+  ~CountVector() {}
+
+  uint64_t get(uint64_t i) const {
+    const auto count = counts_.get(i);
+    return count < max_ ? count : overflows_.find(i)->second;
+  }
+
+  void increment(uint64_t i) {
+    const auto count = counts_.get(i);
+    if (count + 1 < max_) {
+      counts_.set(i, count + 1);
+    } else if (count + 1 == max_) {
+      counts_.set(i, max_);
+      overflows_.insert({i, max_});
+    } else {
+      ++overflows_[i];
+    }
+  }
+
+  // Copies the counter at from to to, e.g., for moving a node to another slot.
+  void copy(uint64_t from, uint64_t to) {
+    clear(to);
+    const auto count = counts_.get(from);
+    counts_.set(to, count);
+    if (count == max_) {
+      overflows_.insert({to, overflows_.find(from)->second});
+    }
+  }
+
+  void clear(uint64_t i) {
+    if (counts_.get(i) == max_) {
+      overflows_.erase(i);
+    }
+    counts_.set(i, 0);
+  }
+
+  uint8_t width() const {
+    return counts_.width();
+  }
+  uint64_t num_overflows() const {
+    return overflows_.size();
+  }
+
+  uint64_t size_in_bytes() const {
+    return counts_.size_in_bytes() + sizeof(max_) + map_bytes(overflows_);
+  }
+  // including the object allocated on the heap and allocator overhead
+  uint64_t allocated_bytes() const {
+    return heap_bytes(sizeof(*this)) + counts_.allocated_bytes() + map_bytes(overflows_);
+  }
+
+  void save(std::ostream& os) const {
+    counts_.save(os);
+    write_value(os, max_);
+    write_value(os, static_cast<uint64_t>(overflows_.size()));
+    for (const auto& overflow : overflows_) {
+      write_value(os, overflow.first);
+      write_value(os, overflow.second);
+    }
+  }
+
+  void load(std::istream& is) {
+    counts_.load(is);
+    read_value(is, max_);
+    uint64_t num_overflows = 0;
+    read_value(is, num_overflows);
+    overflows_.clear();
+    for (uint64_t i = 0; i < num_overflows; ++i) {
+      std::pair<uint64_t, uint64_t> overflow;
+      read_value(is, overflow.first);
+      read_value(is, overflow.second);
+      overflows_.insert(overflows_.end(), overflow);
+    }
+  }
+
+  CountVector(const CountVector&) = delete;
+  CountVector& operator=(const CountVector&) = delete;
+
+private:
+  FitVector counts_;
+  uint64_t max_ = 0; // marking saturated counters
+  std::map<uint64_t, uint64_t> overflows_;
+};
+
+} //bonsais
+
+#endif //BONSAIS_COUNT_VECTOR_HPP
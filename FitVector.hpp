@@ -1,27 +1,66 @@
 #ifndef BONSAIS_FITVECTOR_HPP
 #define BONSAIS_FITVECTOR_HPP
 
-#include "Basics.hpp"
+#include "ChunkBuffer.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define BONSAIS_USE_AVX2_KERNELS // compiled for AVX2 regardless of flags, and chosen at runtime
+#endif
 
 namespace bonsais {
 
 class FitVector {
 public:
   static constexpr uint64_t kChunkWidth = 64;
+  static constexpr uint64_t kLineWidth = 512; // bits per cache line
+  static constexpr uint64_t kChunksPerLine = kLineWidth / kChunkWidth;
+  static constexpr uint64_t kPrefetchDistance = 16; // for bulk kernels
 
   FitVector() {}
 
-  FitVector(uint64_t length, uint8_t width, uint64_t init) {
+  FitVector(uint64_t length, uint8_t width, uint64_t init, const VectorConfig& config = VectorConfig{}) {
     if (width == 0 || 64 < width) {
       std::cerr << "ERROR: not 0 < width <= 64" << std::endl;
       exit(1);
     }
 
+    config_ = config;
     length_ = length;
     width_ = width;
-    mask_ = (1U << width) - 1;
-    chunks_.resize(length_ * width_ / kChunkWidth + 1);
-    for (uint64_t i = 0; i < length; ++i) {
+    mask_ = width == 64 ? UINT64_MAX : (UINT64_C(1) << width) - 1;
+
+    // the bit pattern of elements repeats every period
+    uint64_t period_len = kChunkWidth, period_chunks = width_;
+    uint64_t num_chunks = length_ * width_ / kChunkWidth + 1;
+    if (config.blocked) {
+      per_line_ = kLineWidth / width_;
+      line_magic_ = UINT64_MAX / per_line_ + 1;
+      period_len = per_line_;
+      period_chunks = kChunksPerLine;
+      num_chunks = (length_ / per_line_ + 1) * kChunksPerLine;
+    }
+
+    ChunkBuffer(num_chunks, config).swap(chunks_);
+    data_ = chunks_.data();
+
+    if ((init & mask_) == 0) {
+      return;
+    }
+
+    // sets the first period and copies it
+    uint64_t i = 0;
+    for (; i < length_ && i < period_len; ++i) {
+      set(i, init);
+    }
+    if (i == period_len) {
+      uint64_t pos = period_chunks;
+      for (; pos + period_chunks <= num_chunks; pos += period_chunks) {
+        std::copy(data_, data_ + period_chunks, data_ + pos);
+      }
+      i = pos / period_chunks * period_len;
+    }
+    for (; i < length_; ++i) {
       set(i, init);
     }
   }
@@ -29,24 +68,80 @@ public:
   ~FitVector() {}
 
   uint64_t get(uint64_t i) const {
-    const auto chunk_pos = i * width_ / kChunkWidth;
-    const auto offset = i * width_ % kChunkWidth;
+    const auto bit_pos = bit_pos_(i);
+    const auto chunk_pos = bit_pos / kChunkWidth;
+    const auto offset = bit_pos % kChunkWidth;
     if (offset + width_ <= kChunkWidth) {
-      return (chunks_[chunk_pos] >> offset) & mask_;
+      return (data_[chunk_pos] >> offset) & mask_;
     } else {
-      return ((chunks_[chunk_pos] >> offset)
-              | (chunks_[chunk_pos + 1] << (kChunkWidth - offset))) & mask_;
+      return ((data_[chunk_pos] >> offset)
+              | (data_[chunk_pos + 1] << (kChunkWidth - offset))) & mask_;
+    }
+  }
+
+  void prefetch(uint64_t i) const {
+    __builtin_prefetch(data_ + bit_pos_(i) / kChunkWidth);
+  }
+  // hints reading the page of the i-th element for file-backed vectors larger than half the memory,
+  // whose faults prefetch() does not take
+  void will_need(uint64_t i) const {
+    if (chunks_.hinted()) {
+      chunks_.will_need(bit_pos_(i) / kChunkWidth);
     }
   }
 
   void set(uint64_t i, uint64_t val) {
-    const auto chunk_pos = i * width_ / kChunkWidth;
-    const auto offset = i * width_ % kChunkWidth;
-    chunks_[chunk_pos] &= ~(mask_ << offset);
-    chunks_[chunk_pos] |= (val & mask_) << offset;
+    const auto bit_pos = bit_pos_(i);
+    const auto chunk_pos = bit_pos / kChunkWidth;
+    const auto offset = bit_pos % kChunkWidth;
+    data_[chunk_pos] &= ~(mask_ << offset);
+    data_[chunk_pos] |= (val & mask_) << offset;
     if (kChunkWidth < offset + width_) {
-      chunks_[chunk_pos + 1] &= ~(mask_ >> (kChunkWidth - offset));
-      chunks_[chunk_pos + 1] |= (val & mask_) >> (kChunkWidth - offset);
+      data_[chunk_pos + 1] &= ~(mask_ >> (kChunkWidth - offset));
+      data_[chunk_pos + 1] |= (val & mask_) >> (kChunkWidth - offset);
+    }
+  }
+
+  // Sets the elements at indices[0, num) to out[0, num), gathering four at a time with AVX2 if available.
+  void get_many(const uint64_t* indices, uint64_t num, uint64_t* out) const {
+    uint64_t k = 0;
+#ifdef BONSAIS_USE_AVX2_KERNELS
+    if (per_line_ == 0 && has_avx2_()) {
+      k = get_many_avx2_(indices, num, out);
+    }
+#endif
+    for (; k < num; ++k) {
+      if (k + kPrefetchDistance < num) {
+        prefetch(indices[k + kPrefetchDistance]);
+      }
+      out[k] = get(indices[k]);
+    }
+  }
+
+  // Sets vals[k] at indices[k] in order (there is no scatter in AVX2).
+  void set_many(const uint64_t* indices, const uint64_t* vals, uint64_t num) {
+    for (uint64_t k = 0; k < num; ++k) {
+      if (k + kPrefetchDistance < num) {
+        prefetch(indices[k + kPrefetchDistance]);
+      }
+      set(indices[k], vals[k]);
+    }
+  }
+
+  // Sets the elements in [begin, begin + num) to out, expecting width() <= 32.
+  void unpack(uint64_t begin, uint64_t num, uint32_t* out) const {
+    if (32 < width_) {
+      std::cerr << "ERROR: not width <= 32 for unpacking" << std::endl;
+      exit(1);
+    }
+    uint64_t k = 0;
+#ifdef BONSAIS_USE_AVX2_KERNELS
+    if (per_line_ == 0 && has_avx2_()) {
+      k = unpack_avx2_(begin, num, out);
+    }
+#endif
+    for (; k < num; ++k) {
+      out[k] = static_cast<uint32_t>(get(begin + k));
     }
   }
 
@@ -56,6 +151,24 @@ public:
   uint8_t width() const {
     return width_;
   }
+  bool blocked() const {
+    return per_line_ != 0;
+  }
+  // of the memory actually backing the elements
+  uint64_t page_size() const {
+    return chunks_.page_size();
+  }
+  bool file_backed() const {
+    return chunks_.file_backed();
+  }
+  // of the chunks, including page rounding or allocator overhead, unlike size_in_bytes()
+  uint64_t allocated_bytes() const {
+    return chunks_.allocated_bytes();
+  }
+  // writes back the elements to the file of VectorConfig, if any
+  void sync(bool wait = true) const {
+    chunks_.sync(wait);
+  }
 
   uint64_t size_in_bytes() const {
     size_t ret = 0;
@@ -63,24 +176,133 @@ public:
     ret += sizeof(length_);
     ret += sizeof(width_);
     ret += sizeof(mask_);
+    ret += sizeof(per_line_);
+    ret += sizeof(line_magic_);
+    ret += sizeof(config_);
     return ret;
   }
 
+  void save(std::ostream& os) const {
+    write_value(os, length_);
+    write_value(os, width_);
+    write_value(os, blocked());
+    os.write(reinterpret_cast<const char*>(data_), num_chunks_() * sizeof(uint64_t));
+  }
+
+  void load(std::istream& is) {
+    uint64_t length = 0;
+    uint8_t width = 0;
+    bool blocked = false;
+    read_value(is, length);
+    read_value(is, width);
+    read_value(is, blocked);
+
+    // keeps the page and NUMA settings of this vector
+    auto config = config_;
+    config.blocked = blocked;
+    FitVector(length, width, 0, config).swap(*this);
+    is.read(reinterpret_cast<char*>(data_), num_chunks_() * sizeof(uint64_t));
+  }
+
   void swap(FitVector& rhs) {
     chunks_.swap(rhs.chunks_);
+    std::swap(config_, rhs.config_);
     std::swap(length_, rhs.length_);
     std::swap(width_, rhs.width_);
     std::swap(mask_, rhs.mask_);
+    std::swap(per_line_, rhs.per_line_);
+    std::swap(line_magic_, rhs.line_magic_);
+    std::swap(data_, rhs.data_);
   }
 
   FitVector(const FitVector&) = delete;
   FitVector& operator=(const FitVector&) = delete;
 
 private:
-  std::vector<uint64_t> chunks_;
+  ChunkBuffer chunks_;
+  VectorConfig config_;
   uint64_t length_ = 0;
   uint8_t width_ = 0;
   uint64_t mask_ = 0;
+  uint64_t per_line_ = 0; // #elements in a cache line, or 0 if not blocked
+  uint64_t line_magic_ = 0; // for dividing by per_line_ with a multiplication
+  uint64_t* data_ = nullptr; // of chunks_, aligned to a cache line
+
+  uint64_t num_chunks_() const {
+    return chunks_.size();
+  }
+
+  uint64_t bit_pos_(uint64_t i) const {
+    if (per_line_ == 0) {
+      return i * width_;
+    }
+    // line_magic_ rounds 2^64 / per_line_ up, so the quotient is never too small and is one too large
+    // only for huge i; the remainder then wraps around (modulo 2^64) past per_line_ and is corrected
+    auto line = static_cast<uint64_t>((static_cast<unsigned __int128>(i) * line_magic_) >> 64);
+    auto rem = i - line * per_line_;
+    if (per_line_ <= rem) {
+      --line;
+      rem += per_line_;
+    }
+    return line * kLineWidth + rem * width_;
+  }
+
+#ifdef BONSAIS_USE_AVX2_KERNELS
+  static bool has_avx2_() {
+    static const bool ret = __builtin_cpu_supports("avx2");
+    return ret;
+  }
+
+  // Returns the four elements at indices in the unblocked layout.
+  // The next chunk is read only for elements spanning it, so no padding is needed at the end.
+  __attribute__((target("avx2")))
+  __m256i gather4_(__m256i indices) const {
+    const auto width = _mm256_set1_epi64x(static_cast<long long>(width_));
+    const auto bits = _mm256_set1_epi64x(static_cast<long long>(kChunkWidth));
+    const auto base = reinterpret_cast<const long long*>(data_);
+    // 64-bit products by width_ < 2^32 from two 32-bit ones
+    const auto bit_pos = _mm256_add_epi64(_mm256_mul_epu32(indices, width),
+                                          _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(indices, 32), width), 32));
+    const auto chunk_pos = _mm256_srli_epi64(bit_pos, 6);
+    const auto offset = _mm256_and_si256(bit_pos, _mm256_set1_epi64x(kChunkWidth - 1));
+    const auto spans = _mm256_cmpgt_epi64(_mm256_add_epi64(offset, width), bits);
+    const auto lo = _mm256_i64gather_epi64(base, chunk_pos, 8);
+    const auto hi = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), base + 1, chunk_pos, spans, 8);
+    // shifting by 64 gives 0
+    const auto val = _mm256_or_si256(_mm256_srlv_epi64(lo, offset), _mm256_sllv_epi64(hi, _mm256_sub_epi64(bits, offset)));
+    return _mm256_and_si256(val, _mm256_set1_epi64x(static_cast<long long>(mask_)));
+  }
+
+  // Returns the number of elements processed, leaving the remainder of four.
+  __attribute__((target("avx2")))
+  uint64_t get_many_avx2_(const uint64_t* indices, uint64_t num, uint64_t* out) const {
+    uint64_t k = 0;
+    for (; k + 4 <= num; k += 4) {
+      if (k + kPrefetchDistance + 4 <= num) {
+        for (uint64_t j = 0; j < 4; ++j) {
+          prefetch(indices[k + kPrefetchDistance + j]);
+        }
+      }
+      const auto idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + k));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), gather4_(idx));
+    }
+    return k;
+  }
+
+  __attribute__((target("avx2")))
+  uint64_t unpack_avx2_(uint64_t begin, uint64_t num, uint32_t* out) const {
+    const auto step = _mm256_set1_epi64x(4);
+    const auto low_halves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    auto idx = _mm256_add_epi64(_mm256_set1_epi64x(static_cast<long long>(begin)), _mm256_setr_epi64x(0, 1, 2, 3));
+    uint64_t k = 0;
+    for (; k + 4 <= num; k += 4) {
+      const auto vals = _mm256_permutevar8x32_epi32(gather4_(idx), low_halves);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), _mm256_castsi256_si128(vals));
+      idx = _mm256_add_epi64(idx, step);
+    }
+    return k;
+  }
+#endif
 };
 
 } //bonsais
@@ -0,0 +1,400 @@
+#ifndef BONSAIS_INPUT_STREAM_HPP
+#define BONSAIS_INPUT_STREAM_HPP
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef BONSAIS_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef BONSAIS_USE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef BONSAIS_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Basics.hpp"
+
+namespace bonsais {
+
+/*
+ * Byte stream from a plain, gzip, bzip2 or zstd file. The format is detected from the magic bytes.
+ * */
+class InputStream {
+public:
+  explicit InputStream(const char* file_name) {
+    fp_ = std::fopen(file_name, "rb");
+    if (fp_ == nullptr) {
+      return;
+    }
+
+    uint8_t magic[4] = {};
+    auto num_read = std::fread(magic, 1, sizeof(magic), fp_);
+    std::rewind(fp_);
+
+    if (2 <= num_read && magic[0] == 0x1F && magic[1] == 0x8B) {
+      format_ = Format::gzip;
+    } else if (3 <= num_read && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+      format_ = Format::bzip2;
+    } else if (4 <= num_read && magic[0] == 0x28 && magic[1] == 0xB5
+               && magic[2] == 0x2F && magic[3] == 0xFD) {
+      format_ = Format::zstd;
+    }
+
+    switch (format_) {
+      case Format::plain:
+        break;
+      case Format::gzip:
+#ifdef BONSAIS_USE_ZLIB
+        gz_ = gzopen(file_name, "rb");
+        gzbuffer(gz_, kBufSize);
+        break;
+#else
+        unsupported_();
+#endif
+      case Format::bzip2:
+#ifdef BONSAIS_USE_BZIP2
+      {
+        int err = BZ_OK;
+        bz_ = BZ2_bzReadOpen(&err, fp_, 0, 0, nullptr, 0);
+        if (err != BZ_OK) {
+          error_();
+        }
+        break;
+      }
+#else
+        unsupported_();
+#endif
+      case Format::zstd:
+#ifdef BONSAIS_USE_ZSTD
+        zstd_ = ZSTD_createDStream();
+        ZSTD_initDStream(zstd_);
+        zstd_buf_.resize(ZSTD_DStreamInSize());
+        zstd_in_ = {zstd_buf_.data(), 0, 0};
+        break;
+#else
+        unsupported_();
+#endif
+    }
+  }
+
+  ~InputStream() {
+#ifdef BONSAIS_USE_ZLIB
+    if (gz_ != nullptr) {
+      gzclose(gz_);
+    }
+#endif
+#ifdef BONSAIS_USE_BZIP2
+    if (bz_ != nullptr) {
+      int err = BZ_OK;
+      BZ2_bzReadClose(&err, bz_);
+    }
+#endif
+#ifdef BONSAIS_USE_ZSTD
+    if (zstd_ != nullptr) {
+      ZSTD_freeDStream(zstd_);
+    }
+#endif
+    if (fp_ != nullptr) {
+      std::fclose(fp_);
+    }
+  }
+
+  bool is_ready() const {
+    return fp_ != nullptr;
+  }
+
+  // Reads at most 'size' decompressed bytes into 'buf', and returns #bytes read (0 at the end).
+  uint64_t read(char* buf, uint64_t size) {
+    switch (format_) {
+      case Format::plain:
+        return std::fread(buf, 1, size, fp_);
+      case Format::gzip: {
+#ifdef BONSAIS_USE_ZLIB
+        auto ret = gzread(gz_, buf, static_cast<unsigned>(size));
+        if (ret < 0) {
+          error_();
+        }
+        return static_cast<uint64_t>(ret);
+#else
+        return 0;
+#endif
+      }
+      case Format::bzip2: {
+#ifdef BONSAIS_USE_BZIP2
+        return read_bzip2_(buf, size);
+#else
+        return 0;
+#endif
+      }
+      case Format::zstd: {
+#ifdef BONSAIS_USE_ZSTD
+        return read_zstd_(buf, size);
+#else
+        return 0;
+#endif
+      }
+    }
+    return 0;
+  }
+
+  InputStream(const InputStream&) = delete;
+  InputStream& operator=(const InputStream&) = delete;
+
+private:
+  static constexpr uint64_t kBufSize = 1U << 17;
+
+  enum class Format {
+    plain, gzip, bzip2, zstd
+  };
+
+  FILE* fp_ = nullptr;
+  Format format_ = Format::plain;
+#ifdef BONSAIS_USE_ZLIB
+  gzFile gz_ = nullptr;
+#endif
+#ifdef BONSAIS_USE_BZIP2
+  BZFILE* bz_ = nullptr;
+  bool bz_end_ = false;
+#endif
+#ifdef BONSAIS_USE_ZSTD
+  ZSTD_DStream* zstd_ = nullptr;
+  std::vector<char> zstd_buf_;
+  ZSTD_inBuffer zstd_in_;
+#endif
+
+  void unsupported_() const {
+    std::cerr << "ERROR: the compression format is not supported in this build" << std::endl;
+    exit(1);
+  }
+
+  void error_() const {
+    std::cerr << "ERROR: failed to decompress the input" << std::endl;
+    exit(1);
+  }
+
+#ifdef BONSAIS_USE_BZIP2
+  uint64_t read_bzip2_(char* buf, uint64_t size) {
+    uint64_t ret = 0;
+    while (ret < size && !bz_end_) {
+      int err = BZ_OK;
+      ret += BZ2_bzRead(&err, bz_, buf + ret, static_cast<int>(size - ret));
+      if (err == BZ_STREAM_END) {
+        // concatenated streams such as those written by pbzip2
+        void* unused = nullptr;
+        int num_unused = 0;
+        BZ2_bzReadGetUnused(&err, bz_, &unused, &num_unused);
+        std::vector<char> rest(static_cast<char*>(unused), static_cast<char*>(unused) + num_unused);
+        BZ2_bzReadClose(&err, bz_);
+        bz_ = nullptr;
+        if (rest.empty() && std::feof(fp_)) {
+          bz_end_ = true;
+          break;
+        }
+        bz_ = BZ2_bzReadOpen(&err, fp_, 0, 0, rest.data(), static_cast<int>(rest.size()));
+        if (err != BZ_OK) {
+          error_();
+        }
+      } else if (err != BZ_OK) {
+        error_();
+      }
+    }
+    return ret;
+  }
+#endif
+
+#ifdef BONSAIS_USE_ZSTD
+  uint64_t read_zstd_(char* buf, uint64_t size) {
+    ZSTD_outBuffer out = {buf, size, 0};
+    while (out.pos < out.size) {
+      if (zstd_in_.pos == zstd_in_.size) {
+        zstd_in_.size = std::fread(zstd_buf_.data(), 1, zstd_buf_.size(), fp_);
+        zstd_in_.pos = 0;
+        if (zstd_in_.size == 0) {
+          break;
+        }
+      }
+      if (ZSTD_isError(ZSTD_decompressStream(zstd_, &out, &zstd_in_))) {
+        error_();
+      }
+    }
+    return out.pos;
+  }
+#endif
+};
+
+/*
+ * Blocking FIFO queue with a fixed capacity, for passing items between threads.
+ * */
+template<typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(uint64_t capacity) : capacity_{capacity} {}
+  ~BoundedQueue() {}
+
+  // Returns false if the queue was closed.
+  bool push(T&& item) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Returns false if the queue was closed and is empty.
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty()) {
+      return false;
+    }
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+private:
+  uint64_t capacity_;
+  bool closed_ = false;
+  std::deque<T> items_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+/*
+ * Lines of an input stream split by a background thread into batches, so that reading
+ * and decompression overlap with the consumer. Each line is terminated by '\0' in place of '\n'.
+ * */
+class LineBatchReader {
+public:
+  static constexpr uint64_t kBatchSize = 1U << 20; // bytes
+  static constexpr uint64_t kNumBatches = 8; // in flight
+
+  struct Batch {
+    std::string text;
+    std::vector<uint64_t> begins; // of lines, with the end of text
+  };
+
+  explicit LineBatchReader(const char* file_name)
+    : stream_{file_name}, filled_{kNumBatches}, recycled_{kNumBatches} {
+    if (!stream_.is_ready()) {
+      return;
+    }
+    for (uint64_t i = 0; i < kNumBatches; ++i) {
+      recycled_.push(Batch{});
+    }
+    thread_ = std::thread{&LineBatchReader::produce_, this};
+  }
+
+  ~LineBatchReader() {
+    filled_.close();
+    recycled_.close();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  bool is_ready() const {
+    return stream_.is_ready();
+  }
+
+  // Takes the next batch, returning the previous one for reuse. Returns false at the end.
+  bool next(Batch& batch) {
+    if (!batch.begins.empty()) {
+      recycled_.push(std::move(batch));
+    }
+    batch = Batch{};
+    return filled_.pop(batch);
+  }
+
+  LineBatchReader(const LineBatchReader&) = delete;
+  LineBatchReader& operator=(const LineBatchReader&) = delete;
+
+private:
+  InputStream stream_;
+  BoundedQueue<Batch> filled_;
+  BoundedQueue<Batch> recycled_;
+  std::thread thread_;
+
+  // Fills batches in the background until the end of the stream.
+  void produce_() {
+    std::string carry; // incomplete line at the end of the previous batch
+    Batch batch;
+    bool eof = false;
+
+    while (!eof && recycled_.pop(batch)) {
+      batch.text.assign(carry);
+      carry.clear();
+
+      uint64_t end = 0;
+      do {
+        auto size = batch.text.size();
+        batch.text.resize(size + kBatchSize);
+        auto num_read = read_(&batch.text[size], kBatchSize);
+        batch.text.resize(size + num_read);
+        eof = num_read == 0;
+        end = batch.text.rfind('\n');
+      } while (!eof && end == std::string::npos); // until containing a whole line
+
+      if (!eof) {
+        carry.assign(batch.text, end + 1, std::string::npos);
+        batch.text.resize(end + 1);
+      }
+
+      end = batch.text.size();
+      batch.begins.clear();
+      for (uint64_t begin = 0; begin < end;) {
+        batch.begins.push_back(begin);
+        auto pos = batch.text.find('\n', begin);
+        if (pos == std::string::npos) { // last line without '\n'
+          pos = batch.text.size();
+          batch.text.push_back('\0');
+        }
+        batch.text[pos] = '\0';
+        begin = pos + 1;
+      }
+      batch.begins.push_back(batch.text.size());
+
+      if (batch.begins.size() == 1 || !filled_.push(std::move(batch))) {
+        break;
+      }
+    }
+
+    filled_.close();
+  }
+
+  uint64_t read_(char* buf, uint64_t size) {
+    uint64_t ret = 0;
+    while (ret < size) {
+      auto num_read = stream_.read(buf + ret, size - ret);
+      if (num_read == 0) {
+        break;
+      }
+      ret += num_read;
+    }
+    return ret;
+  }
+};
+
+} //bonsais
+
+#endif //BONSAIS_INPUT_STREAM_HPP
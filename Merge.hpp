@@ -0,0 +1,161 @@
+#ifndef BONSAIS_MERGE_HPP
+#define BONSAIS_MERGE_HPP
+
+#include "FitVector.hpp"
+
+namespace bonsais {
+
+struct MergeConfig {
+  double load_factor = 0.9; // of the merged trie
+  uint8_t width = 8; // width_1st or colls_bits of the merged trie
+  VectorConfig vector;
+  uint32_t num_threads = std::max(std::thread::hardware_concurrency(), 1U);
+};
+
+// Appends the strings of a trie to keys in no particular order by walking up from their final nodes,
+// where start(pos, node) sets the node at pos and returns true if it is final and not the root,
+// step(node) moves it to the parent and returns the byte on the edge (or a negative value to be called again
+// for the same edge, e.g., after prefetching), and is_root(node) tells the end.
+// Each thread walks from the final nodes in its range of slots, interleaving kNumWalks walks
+// so that step() can prefetch the parents.
+template<typename Node, typename Start, typename Step, typename IsRoot>
+void walk_up_keys(uint64_t num_slots, uint32_t num_threads, Start start, Step step, IsRoot is_root,
+                  std::vector<std::string>& keys) {
+  constexpr uint64_t kNumWalks = 16;
+
+  struct Walk {
+    Node node;
+    std::string key; // reversed
+  };
+
+  std::vector<std::vector<std::string>> found(num_threads);
+  parallel_for(num_slots, num_threads, [&](uint32_t thread_id, uint64_t begin, uint64_t end) {
+    auto pos = begin;
+    auto restart = [&](Walk& walk) {
+      walk.key.clear();
+      while (pos < end) {
+        if (start(pos++, walk.node)) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    std::vector<Walk> walks(kNumWalks);
+    uint64_t num_walks = 0;
+    while (num_walks < kNumWalks && restart(walks[num_walks])) {
+      ++num_walks;
+    }
+
+    while (num_walks != 0) {
+      for (uint64_t i = 0; i < num_walks;) {
+        auto& walk = walks[i];
+        const int byte = step(walk.node);
+        if (byte < 0) {
+          ++i;
+          continue;
+        }
+        walk.key.push_back(static_cast<char>(byte));
+        if (is_root(walk.node)) {
+          found[thread_id].emplace_back(walk.key.rbegin(), walk.key.rend());
+          if (!restart(walk)) {
+            std::swap(walk, walks[--num_walks]);
+            continue;
+          }
+        }
+        ++i;
+      }
+    }
+  });
+
+  for (auto& strs : found) {
+    std::move(strs.begin(), strs.end(), std::back_inserter(keys));
+  }
+}
+
+// Sorts keys by sorting num_threads parts in parallel and merging them pairwise.
+inline void parallel_sort(std::vector<std::string>& keys, uint32_t num_threads) {
+  num_threads = std::max<uint32_t>(num_threads, 1);
+  const uint64_t step = (keys.size() + num_threads - 1) / num_threads;
+
+  parallel_for(keys.size(), num_threads, [&](uint32_t, uint64_t begin, uint64_t end) {
+    std::sort(keys.begin() + begin, keys.begin() + end);
+  });
+
+  for (uint64_t width = step; 0 < width && width < keys.size(); width *= 2) {
+    const uint64_t num_pairs = (keys.size() + 2 * width - 1) / (2 * width);
+    parallel_for(num_pairs, static_cast<uint32_t>(num_pairs), [&](uint32_t, uint64_t begin, uint64_t end) {
+      for (uint64_t i = begin; i < end; ++i) {
+        const auto first = keys.begin() + i * 2 * width;
+        const auto middle = keys.begin() + std::min<uint64_t>(keys.size(), i * 2 * width + width);
+        const auto last = keys.begin() + std::min<uint64_t>(keys.size(), (i + 1) * 2 * width);
+        std::inplace_merge(first, middle, last);
+      }
+    });
+  }
+}
+
+// Returns the number of nodes, including the root, of the trie of sorted and distinct keys.
+inline uint64_t count_nodes(const std::vector<std::string>& keys) {
+  uint64_t ret = 1;
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    uint64_t lcp = 0;
+    if (i != 0) {
+      const auto& prev = keys[i - 1];
+      const auto& key = keys[i];
+      const auto max_lcp = std::min(prev.size(), key.size());
+      while (lcp < max_lcp && prev[lcp] == key[lcp]) {
+        ++lcp;
+      }
+    }
+    ret += keys[i].size() - lcp;
+  }
+  return ret;
+}
+
+/*
+ * Merges tries of type T (BonsaiDCW or BonsaiPR) into a new one sized exactly for the union of their strings.
+ * The strings are enumerated by inverting the hash functions, and bulk-loaded in sorted order on one thread,
+ * which is slower than inserting them again if they are at hand. Neither typed strings nor counters are restored,
+ * so tries having them are rejected.
+ * */
+template<typename T>
+std::unique_ptr<T> merge_all(const std::vector<const T*>& tries, const MergeConfig& config) {
+  std::vector<std::string> keys;
+  uint64_t alp_size = 1;
+  for (const auto trie : tries) {
+    if (trie->typed() || trie->counts() != nullptr) {
+      std::cerr << "ERROR: tries with typed strings or counters cannot be merged" << std::endl;
+      exit(1);
+    }
+    trie->enumerate(keys, config.num_threads);
+    alp_size = std::max(alp_size, trie->alp_size());
+  }
+
+  parallel_sort(keys, config.num_threads);
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  const auto num_nodes = count_nodes(keys);
+  const auto num_slots = std::max(static_cast<uint64_t>(std::ceil(num_nodes / config.load_factor)), num_nodes + 1);
+  std::unique_ptr<T> ret{new T{num_slots, alp_size, config.width, config.vector}};
+
+  // consecutive keys share prefixes whose nodes stay in cache
+  for (const auto& key : keys) {
+    ret->insert(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+  }
+
+  if (ret->num_nodes() != num_nodes || ret->num_strs() != keys.size()) {
+    std::cerr << "ERROR: failed to merge tries" << std::endl;
+    exit(1);
+  }
+  return ret;
+}
+
+template<typename T>
+std::unique_ptr<T> merge(const T& a, const T& b, const MergeConfig& config) {
+  return merge_all<T>({&a, &b}, config);
+}
+
+} //bonsais
+
+#endif //BONSAIS_MERGE_HPP
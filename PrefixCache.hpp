@@ -0,0 +1,130 @@
+#ifndef BONSAIS_PREFIX_CACHE_HPP
+#define BONSAIS_PREFIX_CACHE_HPP
+
+#include "Basics.hpp"
+
+namespace bonsais {
+
+/*
+ * Direct-mapped table from prefixes of up to a given depth to their nodes, for skipping the first levels of walks.
+ * A prefix is identified by a tag packing its symbols of 8 bits after a leading 1 bit, so that prefixes of
+ * different depths have different tags and the depth is at most kMaxDepth.
+ * */
+class PrefixCache {
+public:
+  static constexpr uint8_t kMaxDepth = 7;
+  static constexpr uint64_t kEmptyTag = 1; // of the empty prefix
+
+  PrefixCache(uint8_t depth, uint64_t num_entries) {
+    if (depth == 0 || kMaxDepth < depth) {
+      std::cerr << "ERROR: not 0 < depth <= " << (uint32_t) kMaxDepth << std::endl;
+      exit(1);
+    }
+    depth_ = depth;
+    num_entries = UINT64_C(1) << num_bits(std::max<uint64_t>(num_entries, 2) - 1); // power of two
+    shift_ = static_cast<uint8_t>(64 - num_bits(num_entries - 1));
+    entries_.resize(num_entries, Entry{0, 0});
+  }
+  ~PrefixCache() {}
+
+  uint8_t depth() const {
+    return depth_;
+  }
+
+  // Returns the tag of the prefix of tag followed by symbol,
+  // or 0 if tag is 0 or already of depth() symbols, or if symbol exceeds 8 bits.
+  uint64_t extend_tag(uint64_t tag, uint64_t symbol) const {
+    if (tag == 0 || (tag >> (8 * depth_)) != 0 || UINT8_MAX < symbol) {
+      return 0;
+    }
+    return (tag << 8) | symbol;
+  }
+
+  // Packs the first depth (<= depth()) symbols given by get_symbol(i) into a tag, or returns 0 if one exceeds 8 bits.
+  template<typename F>
+  uint64_t make_tag(F get_symbol, uint64_t depth) const {
+    uint64_t tag = kEmptyTag;
+    for (uint64_t i = 0; i < depth; ++i) {
+      tag = extend_tag(tag, get_symbol(i));
+    }
+    return tag;
+  }
+
+  // Finds the longest cached prefix of the first len symbols given by get_symbol(i), sets its tag and node,
+  // and returns its depth. If none is cached, returns 0 setting the tag of the empty prefix.
+  template<typename F>
+  uint64_t find_longest(uint64_t len, F get_symbol, uint64_t& tag, uint64_t& node) const {
+    uint64_t tags[kMaxDepth + 1] = {kEmptyTag};
+    uint64_t depth = 0;
+    for (; depth < std::min<uint64_t>(len, depth_); ++depth) {
+      tags[depth + 1] = extend_tag(tags[depth], get_symbol(depth));
+      if (tags[depth + 1] == 0) {
+        break;
+      }
+    }
+    num_lookups_.add();
+    for (; depth != 0; --depth) {
+      const auto& entry = entries_[index_(tags[depth])];
+      if (entry.tag == tags[depth]) {
+        num_hits_.add();
+        num_skipped_.add(depth);
+        tag = entry.tag;
+        node = entry.node;
+        return depth;
+      }
+    }
+    tag = kEmptyTag;
+    return 0;
+  }
+
+  // replacing the prefix in the same entry
+  void store(uint64_t tag, uint64_t node) {
+    if (tag == 0) {
+      return;
+    }
+    entries_[index_(tag)] = Entry{tag, node};
+  }
+
+  // of lookups finding a prefix
+  double hit_rate() const {
+    const auto num_lookups = num_lookups_.get();
+    return num_lookups == 0 ? 0.0 : static_cast<double>(num_hits_.get()) / num_lookups;
+  }
+  // average depth of the prefixes found per lookup
+  double skipped_depth() const {
+    const auto num_lookups = num_lookups_.get();
+    return num_lookups == 0 ? 0.0 : static_cast<double>(num_skipped_.get()) / num_lookups;
+  }
+
+  uint64_t size_in_bytes() const {
+    return entries_.size() * sizeof(Entry) + sizeof(depth_) + sizeof(shift_);
+  }
+  // including the object allocated on the heap and allocator overhead
+  uint64_t allocated_bytes() const {
+    return heap_bytes(sizeof(*this)) + heap_bytes(entries_.capacity() * sizeof(Entry));
+  }
+
+  PrefixCache(const PrefixCache&) = delete;
+  PrefixCache& operator=(const PrefixCache&) = delete;
+
+private:
+  struct Entry {
+    uint64_t tag; // 0 if empty
+    uint64_t node;
+  };
+
+  uint8_t depth_ = 0;
+  uint8_t shift_ = 0;
+  std::vector<Entry> entries_;
+  mutable ShardedCounter num_lookups_;
+  mutable ShardedCounter num_hits_;
+  mutable ShardedCounter num_skipped_; // levels
+
+  uint64_t index_(uint64_t tag) const {
+    return (tag * UINT64_C(0x9E3779B97F4A7C15)) >> shift_;
+  }
+};
+
+} //bonsais
+
+#endif //BONSAIS_PREFIX_CACHE_HPP
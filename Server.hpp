@@ -0,0 +1,370 @@
+#ifndef BONSAIS_SERVER_HPP
+#define BONSAIS_SERVER_HPP
+
+#include <cerrno>
+#include <unordered_map>
+
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "WriteAheadLog.hpp"
+
+namespace bonsais {
+
+/*
+ * Binary protocol over a Unix domain socket. A request is
+ *   op (1 byte) | len (4 bytes, little endian) | str (len bytes),
+ * answered by a single byte (1 if found, inserted or matched, otherwise 0) in the order of the requests
+ * on each connection, so that clients can pipeline them.
+ * */
+enum class Op : uint8_t {
+  search = 0, insert = 1, prefix = 2, shutdown = 3
+};
+
+constexpr uint64_t kRequestHeaderSize = 5;
+constexpr uint32_t kMaxRequestLen = 1U << 20;
+
+inline void append_request(std::string& buf, Op op, const void* str, uint32_t len) {
+  buf.push_back(static_cast<char>(op));
+  for (uint32_t i = 0; i < 4; ++i) {
+    buf.push_back(static_cast<char>(len >> (i * 8)));
+  }
+  buf.append(static_cast<const char*>(str), len);
+}
+
+#ifdef __linux__
+
+/*
+ * Single-threaded server on an epoll event loop (so only on Linux). The requests read from all the ready
+ * connections are coalesced into a batch, where consecutive searches are walked together by search_all(),
+ * and inserts are made durable by a single sync of the log before the replies are sent.
+ * */
+template<typename T>
+class Server {
+public:
+  static constexpr uint64_t kMaxEvents = 256;
+  static constexpr uint64_t kReadSize = 1U << 16;
+  static constexpr uint64_t kMaxPending = 1U << 20; // unsent replies over which reading is paused
+
+  Server(T& bonsai, const char* path, WriteAheadLog* log = nullptr) : bonsai_(bonsai), log_{log}, path_{path} {
+    sockaddr_un addr{};
+    if (sizeof(addr.sun_path) <= path_.size()) {
+      std::cerr << "ERROR: too long socket path " << path_ << std::endl;
+      exit(1);
+    }
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path_.c_str());
+
+    ::unlink(path_.c_str());
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(listen_fd_, SOMAXCONN) != 0) {
+      std::cerr << "ERROR: failed to listen on " << path_ << std::endl;
+      exit(1);
+    }
+
+    epoll_fd_ = ::epoll_create1(0);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // for the listening socket
+    if (epoll_fd_ < 0 || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) {
+      std::cerr << "ERROR: failed to create epoll" << std::endl;
+      exit(1);
+    }
+  }
+
+  ~Server() {
+    for (auto& entry : conns_) {
+      ::close(entry.first);
+    }
+    ::close(epoll_fd_);
+    ::close(listen_fd_);
+    ::unlink(path_.c_str());
+  }
+
+  // Serves until a shutdown request, and returns the number of requests served.
+  uint64_t run() {
+    std::vector<epoll_event> events(kMaxEvents);
+    std::vector<Connection*> ready;
+    std::vector<int> closing; // closed at the end of each round
+
+    while (!stopping_) {
+      const int num_events = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+      if (num_events < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "ERROR: failed to wait for events" << std::endl;
+        exit(1);
+      }
+
+      ready.clear();
+      closing.clear();
+      for (int i = 0; i < num_events; ++i) {
+        auto conn = static_cast<Connection*>(events[i].data.ptr);
+        if (conn == nullptr) {
+          accept_();
+          continue;
+        }
+        if ((events[i].events & EPOLLOUT) && !flush_(*conn)) {
+          closing.push_back(conn->fd);
+          continue;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof) {
+          if (!read_(*conn)) {
+            closing.push_back(conn->fd);
+          }
+          ready.push_back(conn);
+        }
+      }
+
+      // coalescing the requests of all the ready connections
+      batch_.clear();
+      for (auto conn : ready) {
+        if (!parse_(*conn)) {
+          closing.push_back(conn->fd);
+        }
+      }
+      process_();
+
+      for (auto conn : ready) {
+        conn->in.erase(0, conn->in_pos);
+        conn->in_pos = 0;
+        if (!flush_(*conn)) {
+          closing.push_back(conn->fd);
+        }
+      }
+      for (auto fd : closing) {
+        close_(fd);
+      }
+    }
+    return num_served_;
+  }
+
+  uint64_t num_served() const { return num_served_; }
+  uint64_t num_batches() const { return num_batches_; }
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+private:
+  struct Connection {
+    int fd;
+    std::string in;
+    uint64_t in_pos; // of the next request
+    std::string out; // with a byte reserved for each parsed request
+    uint64_t out_pos;
+    bool eof; // the client has finished sending, so closed once the replies are sent
+    uint32_t events; // registered to epoll
+  };
+  struct Request {
+    Connection* conn;
+    Op op;
+    const uint8_t* str;
+    uint64_t len;
+    uint64_t reply_pos;
+  };
+
+  T& bonsai_;
+  WriteAheadLog* log_;
+  std::string path_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+
+  std::vector<char> read_buf_ = std::vector<char>(kReadSize);
+  std::vector<Request> batch_;
+  std::vector<const uint8_t*> strs_;
+  std::vector<uint64_t> lens_;
+  std::unique_ptr<bool[]> found_;
+  uint64_t found_size_ = 0;
+
+  bool stopping_ = false;
+  uint64_t num_served_ = 0;
+  uint64_t num_batches_ = 0;
+
+  void accept_() {
+    while (true) {
+      const int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+      if (fd < 0) {
+        return; // EAGAIN, or the client gave up
+      }
+      std::unique_ptr<Connection> conn{new Connection{fd, std::string{}, 0, std::string{}, 0, false, EPOLLIN}};
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.ptr = conn.get();
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        ::close(fd);
+        continue;
+      }
+      conns_[fd] = std::move(conn);
+    }
+  }
+
+  // Returns false on errors.
+  bool read_(Connection& conn) {
+    while (true) {
+      const auto ret = ::recv(conn.fd, read_buf_.data(), read_buf_.size(), 0);
+      if (0 < ret) {
+        conn.in.append(read_buf_.data(), ret);
+      }
+      if (ret < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+      if (ret == 0) {
+        conn.eof = true;
+        return true;
+      }
+      if (static_cast<uint64_t>(ret) < kReadSize) {
+        return true;
+      }
+    }
+  }
+
+  // Appends the complete requests of conn to the batch, and returns false on a malformed one.
+  bool parse_(Connection& conn) {
+    const auto data = reinterpret_cast<const uint8_t*>(conn.in.data());
+    while (conn.in_pos + kRequestHeaderSize <= conn.in.size()) {
+      const auto header = data + conn.in_pos;
+      uint32_t len = 0;
+      for (uint32_t i = 0; i < 4; ++i) {
+        len |= static_cast<uint32_t>(header[1 + i]) << (i * 8);
+      }
+      if (static_cast<uint8_t>(Op::shutdown) < header[0] || kMaxRequestLen < len) {
+        return false;
+      }
+      if (conn.in.size() < conn.in_pos + kRequestHeaderSize + len) {
+        break;
+      }
+      batch_.push_back({&conn, static_cast<Op>(header[0]), header + kRequestHeaderSize, len, conn.out.size()});
+      conn.out.push_back(0);
+      conn.in_pos += kRequestHeaderSize + len;
+    }
+    return true;
+  }
+
+  void process_() {
+    if (batch_.empty()) {
+      return;
+    }
+    ++num_batches_;
+
+    bool inserted = false;
+    for (uint64_t begin = 0, end = 0; begin < batch_.size(); begin = end) {
+      end = begin + 1;
+      const auto& req = batch_[begin];
+      switch (req.op) {
+        case Op::search:
+          while (end < batch_.size() && batch_[end].op == Op::search) {
+            ++end;
+          }
+          search_(begin, end);
+          break;
+        case Op::insert:
+          req.conn->out[req.reply_pos] = bonsai_.insert(req.str, req.len);
+          inserted = true;
+          break;
+        case Op::prefix:
+          req.conn->out[req.reply_pos] = bonsai_.contains_prefix(req.str, req.len);
+          break;
+        case Op::shutdown:
+          req.conn->out[req.reply_pos] = 1;
+          stopping_ = true;
+          break;
+      }
+    }
+    num_served_ += batch_.size();
+
+    // group commit before replying
+    if (inserted && log_ != nullptr) {
+      log_->sync();
+    }
+  }
+
+  void search_(uint64_t begin, uint64_t end) {
+    const auto num = end - begin;
+    strs_.resize(num);
+    lens_.resize(num);
+    for (uint64_t i = 0; i < num; ++i) {
+      strs_[i] = batch_[begin + i].str;
+      lens_[i] = batch_[begin + i].len;
+    }
+    if (found_size_ < num) {
+      found_size_ = std::max(num, found_size_ * 2);
+      found_.reset(new bool[found_size_]);
+    }
+    bonsai_.search_all(strs_.data(), lens_.data(), num, found_.get());
+    for (uint64_t i = 0; i < num; ++i) {
+      const auto& req = batch_[begin + i];
+      req.conn->out[req.reply_pos] = found_[i];
+    }
+  }
+
+  // Sends the replies as much as possible, queueing the rest until EPOLLOUT, and returns false on errors
+  // or when the connection is done.
+  bool flush_(Connection& conn) {
+    while (conn.out_pos < conn.out.size()) {
+      const auto ret = ::send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          return false;
+        }
+        break;
+      }
+      conn.out_pos += ret;
+    }
+    if (conn.out_pos == conn.out.size()) {
+      conn.out.clear();
+      conn.out_pos = 0;
+    } else if (kMaxPending <= conn.out_pos) {
+      conn.out.erase(0, conn.out_pos);
+      conn.out_pos = 0;
+    }
+
+    // stops reading at the end of the stream, or while the client lags behind its replies
+    const uint64_t pending = conn.out.size() - conn.out_pos;
+    uint32_t events = 0;
+    if (!conn.eof && pending < kMaxPending) {
+      events |= EPOLLIN;
+    }
+    if (0 < pending) {
+      events |= EPOLLOUT;
+    }
+    if (events == 0) {
+      return false;
+    }
+    if (events != conn.events) {
+      epoll_event ev{};
+      ev.events = events;
+      ev.data.ptr = &conn;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev) != 0) {
+        return false;
+      }
+      conn.events = events;
+    }
+    return true;
+  }
+
+  void close_(int fd) {
+    if (conns_.find(fd) == conns_.end()) {
+      return; // already closed
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    conns_.erase(fd);
+  }
+};
+
+#endif
+
+} //bonsais
+
+#endif //BONSAIS_SERVER_HPP
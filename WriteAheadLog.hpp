@@ -0,0 +1,173 @@
+#ifndef BONSAIS_WRITE_AHEAD_LOG_HPP
+#define BONSAIS_WRITE_AHEAD_LOG_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+
+#include "Basics.hpp"
+
+namespace bonsais {
+
+/*
+ * Append-only log of inserted strings, each stored as a 32-bit length followed by its bytes.
+ * Records are buffered and made durable together (group commit) every group_size records,
+ * every kMaxBufferSize bytes, or on sync().
+ * */
+class WriteAheadLog {
+public:
+  static constexpr uint64_t kMaxBufferSize = 1U << 20;
+
+  WriteAheadLog(const char* file_name, uint64_t group_size = 1024) {
+    fd_ = ::open(file_name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ == -1) {
+      std::cerr << "ERROR: failed to open " << file_name << std::endl;
+      exit(1);
+    }
+    group_size_ = group_size;
+    buf_.reserve(kMaxBufferSize + (1U << 10));
+  }
+
+  ~WriteAheadLog() {
+    sync();
+    ::close(fd_);
+  }
+
+  void append(const uint8_t* str, uint64_t len) {
+    const auto len32 = static_cast<uint32_t>(len);
+    assert(len32 == len);
+    buf_.append(reinterpret_cast<const char*>(&len32), sizeof(len32));
+    buf_.append(reinterpret_cast<const char*>(str), len);
+    ++num_records_;
+    if (group_size_ <= ++num_pending_ || kMaxBufferSize <= buf_.size()) {
+      sync();
+    }
+  }
+
+  // Writes the buffered records and waits until they reach the disk.
+  void sync() {
+    if (num_pending_ == 0) {
+      return;
+    }
+    const char* ptr = buf_.data();
+    uint64_t rest = buf_.size();
+    while (rest != 0) {
+      auto ret = ::write(fd_, ptr, rest);
+      if (ret == -1) {
+        std::cerr << "ERROR: failed to write the log" << std::endl;
+        exit(1);
+      }
+      ptr += ret;
+      rest -= ret;
+    }
+#ifdef __APPLE__
+    ::fsync(fd_);
+#else
+    ::fdatasync(fd_);
+#endif
+    buf_.clear();
+    num_pending_ = 0;
+    ++num_syncs_;
+  }
+
+  // Discards all records, e.g., after an image of the trie is saved.
+  void clear() {
+    buf_.clear();
+    num_pending_ = 0;
+    if (::ftruncate(fd_, 0) == -1) {
+      std::cerr << "ERROR: failed to truncate the log" << std::endl;
+      exit(1);
+    }
+  }
+
+  // Saves an image of the trie to img_name and then discards all records covered by it.
+  // The image is written to a temporary file and renamed, and both the file and its directory are
+  // made durable before the log is truncated, so that a crash leaves either image with its log.
+  template<typename T>
+  void checkpoint(const T& trie, const std::string& img_name) {
+    const auto tmp_name = img_name + ".tmp";
+    {
+      std::ofstream ofs{tmp_name, std::ios::binary};
+      trie.save(ofs);
+      if (!ofs.flush()) {
+        std::cerr << "ERROR: failed to write " << tmp_name << std::endl;
+        exit(1);
+      }
+    }
+    sync_path_(tmp_name.c_str(), O_RDONLY);
+    if (std::rename(tmp_name.c_str(), img_name.c_str()) != 0) {
+      std::cerr << "ERROR: failed to rename " << tmp_name << std::endl;
+      exit(1);
+    }
+    const auto slash = img_name.rfind('/');
+    const auto dir_name = slash == std::string::npos ? std::string{"."} : img_name.substr(0, slash + 1);
+    sync_path_(dir_name.c_str(), O_RDONLY | O_DIRECTORY);
+    clear();
+  }
+
+  uint64_t num_records() const { return num_records_; }
+  uint64_t num_syncs() const { return num_syncs_; }
+
+  // Inserts all complete records of the log into the trie one by one (faster than insert_all() in memory),
+  // and returns the number of them.
+  // An incomplete record at the tail (e.g., due to a crash) is truncated.
+  template<typename T>
+  static uint64_t replay(const char* file_name, T& trie) {
+    std::ifstream ifs{file_name, std::ios::binary};
+    if (!ifs) {
+      return 0;
+    }
+
+    uint64_t num_records = 0, valid_size = 0;
+    uint32_t len = 0;
+    std::string str;
+
+    ifs.seekg(0, std::ios::end);
+    const auto file_size = static_cast<uint64_t>(ifs.tellg());
+    ifs.seekg(0);
+
+    while (ifs.read(reinterpret_cast<char*>(&len), sizeof(len))) {
+      str.resize(len);
+      if (!ifs.read(&str[0], len)) {
+        break;
+      }
+      trie.insert(reinterpret_cast<const uint8_t*>(str.data()), len);
+      ++num_records;
+      valid_size += sizeof(len) + len;
+    }
+
+    if (valid_size < file_size) { // including a length without any bytes of the string
+      ifs.close();
+      if (::truncate(file_name, valid_size) == -1) {
+        std::cerr << "ERROR: failed to truncate " << file_name << std::endl;
+        exit(1);
+      }
+    }
+    return num_records;
+  }
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+private:
+  int fd_ = -1;
+  uint64_t group_size_ = 0;
+  uint64_t num_pending_ = 0;
+  uint64_t num_records_ = 0;
+  uint64_t num_syncs_ = 0;
+  std::string buf_;
+
+  static void sync_path_(const char* path, int flags) {
+    const int fd = ::open(path, flags);
+    if (fd == -1 || ::fsync(fd) == -1) {
+      std::cerr << "ERROR: failed to sync " << path << std::endl;
+      exit(1);
+    }
+    ::close(fd);
+  }
+};
+
+} //bonsais
+
+#endif //BONSAIS_WRITE_AHEAD_LOG_HPP
@@ -1,85 +1,68 @@
+#include <cstdio>
 #include <cstring>
 #include <chrono>
 #include <fstream>
 #include <stack>
+#include <unordered_map>
+
+#include <sys/resource.h>
 
 #include "BonsaiDCW.hpp"
 #include "BonsaiPR.hpp"
+#include "InputStream.hpp"
+#include "Merge.hpp"
+#include "Server.hpp"
 
 using namespace bonsais;
 
 namespace {
 
-enum class Times {
-  sec, milli, micro
-};
-
-class StopWatch {
-public:
-  StopWatch() : tp_(std::chrono::high_resolution_clock::now()) {}
-  ~StopWatch() {}
-
-  double operator()(Times type) const {
-    auto tp = std::chrono::high_resolution_clock::now() - tp_;
-    switch (type) {
-      case Times::sec:
-        return std::chrono::duration<double>(tp).count();
-      case Times::milli:
-        return std::chrono::duration<double, std::milli>(tp).count();
-      case Times::micro:
-        return std::chrono::duration<double, std::micro>(tp).count();
-    }
-    return 0.0;
-  }
-
-  StopWatch(const StopWatch&) = delete;
-  StopWatch& operator=(const StopWatch&) = delete;
-
-private:
-  std::chrono::high_resolution_clock::time_point tp_;
-};
-
 class KeyReader {
 public:
-  KeyReader(const char* file_name) {
-    std::ios::sync_with_stdio(false);
-    buf_.reserve(1 << 10);
-    ifs_.open(file_name);
-  }
+  KeyReader(const char* file_name) : reader_{file_name} {}
   ~KeyReader() {}
 
   bool is_ready() const {
-    return !ifs_.fail();
+    return reader_.is_ready();
   }
 
-  const std::string& next() {
-    std::getline(ifs_, buf_);
-    return buf_;
+  // Returns the next key terminated by '\0' and sets its length, or returns nullptr at the end.
+  const char* next(uint64_t& len) {
+    while (batch_.begins.size() <= pos_ + 1) {
+      if (!reader_.next(batch_)) {
+        return nullptr;
+      }
+      pos_ = 0;
+    }
+    const auto begin = batch_.begins[pos_++];
+    len = batch_.begins[pos_] - begin - 1;
+    return &batch_.text[begin];
   }
 
   KeyReader(const KeyReader&) = delete;
   KeyReader& operator=(const KeyReader&) = delete;
 
 private:
-  std::ifstream ifs_;
-  std::string buf_;
+  LineBatchReader reader_;
+  LineBatchReader::Batch batch_;
+  uint64_t pos_ = 0;
 };
 
 std::vector<std::string> read_keys(const char* file_name) {
-  std::ifstream ifs{file_name};
-  if (!ifs) {
+  KeyReader reader{file_name};
+  if (!reader.is_ready()) {
     std::cerr << "ERROR: failed to open " << file_name << std::endl;
     return {};
   }
 
-  std::string line;
   std::vector<std::string> keys;
 
-  while (std::getline(ifs, line)) {
-    if (line.empty()) {
+  uint64_t len = 0;
+  while (auto key = reader.next(len)) {
+    if (len == 0) {
       continue;
     }
-    keys.push_back(line);
+    keys.emplace_back(key, len);
   }
 
   return keys;
@@ -130,52 +113,452 @@ uint64_t count_num_nodes(const char* file_name) {
   return num_nodes + keys.size(); // including terminators
 }
 
+struct Options {
+  VectorConfig config;
+  const char* wal_name = nullptr;
+  uint64_t batch_size = 0;
+  uint8_t filter_bits = 0; // per key
+  uint8_t cache_depth = 0; // of prefixes
+  const char* socket_name = nullptr; // for serving
+  uint32_t ngram_order = 0; // for counting n-grams
+  uint32_t num_threads = 0; // for searching in parallel
+  const char* scan_name = nullptr; // text to find the keys in
+};
+
+bool parse_options(int argc, const char* argv[], Options& opts) {
+  for (int i = 7; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--blocked") == 0) {
+      opts.config.blocked = true;
+    } else if (std::strcmp(argv[i], "--pages") == 0 && i + 1 < argc) {
+      const char* pages = argv[++i];
+      if (std::strcmp(pages, "thp") == 0) {
+        opts.config.pages = PageType::transparent;
+      } else if (std::strcmp(pages, "2m") == 0) {
+        opts.config.pages = PageType::huge_2m;
+      } else if (std::strcmp(pages, "1g") == 0) {
+        opts.config.pages = PageType::huge_1g;
+      } else if (std::strcmp(pages, "normal") != 0) {
+        std::cerr << "ERROR: unknown page type " << pages << std::endl;
+        return false;
+      }
+    } else if (std::strcmp(argv[i], "--numa") == 0 && i + 1 < argc) {
+      const char* numa = argv[++i];
+      if (std::strcmp(numa, "interleave") == 0) {
+        opts.config.numa = NumaPolicy::interleave;
+      } else if (std::strcmp(numa, "local") == 0) {
+        opts.config.numa = NumaPolicy::local;
+      } else {
+        std::cerr << "ERROR: unknown NUMA policy " << numa << std::endl;
+        return false;
+      }
+    } else if (std::strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+      opts.config.file = argv[++i];
+    } else if (std::strcmp(argv[i], "--wal") == 0 && i + 1 < argc) {
+      opts.wal_name = argv[++i];
+    } else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      opts.batch_size = static_cast<uint64_t>(std::atoll(argv[++i]));
+    } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      opts.filter_bits = static_cast<uint8_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--scan") == 0 && i + 1 < argc) {
+      opts.scan_name = argv[++i];
+    } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      opts.num_threads = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+    } else if (std::strcmp(argv[i], "--ngram") == 0 && i + 1 < argc) {
+      opts.ngram_order = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+#ifdef __linux__
+      opts.socket_name = argv[++i];
+#else
+      std::cerr << "ERROR: --serve is supported only on Linux" << std::endl;
+      return false;
+#endif
+    } else if (std::strcmp(argv[i], "--prefix-cache") == 0 && i + 1 < argc) {
+      opts.cache_depth = static_cast<uint8_t>(std::atoi(argv[++i]));
+    } else {
+      std::cerr << "ERROR: unknown option " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename T>
+void insert_all(T& bonsai, const std::vector<std::string>& keys) {
+  std::vector<const uint8_t*> strs(keys.size());
+  std::vector<uint64_t> lens(keys.size());
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    strs[i] = reinterpret_cast<const uint8_t*>(keys[i].data());
+    lens[i] = keys[i].size();
+  }
+  bonsai.insert_all(strs.data(), lens.data(), keys.size());
+}
+
 template<typename T>
-int benchmark(const char* argv[]) {
+void search_keys(const T& bonsai, const char* file_name) {
+  auto keys = read_keys(file_name);
+  uint64_t ok = 0, ng = 0;
+  StopWatch sw;
+  for (const auto& key : keys) {
+    auto ptr = reinterpret_cast<const uint8_t*>(key.c_str());
+    auto len = key.size() + 1; // including terminators
+    if (bonsai.search(ptr, len)) {
+      ++ok;
+    } else {
+      ++ng;
+    }
+  }
+  std::cout << "OK: " << ok << ", NG: " << ng << std::endl;
+  std::cout << "search time: " << sw(Times::micro) / keys.size() << " (us/key)" << std::endl;
+}
+
+// Returns the peak resident set size of the process in bytes.
+uint64_t peak_rss() {
+  rusage usage{};
+  ::getrusage(RUSAGE_SELF, &usage);
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // in KiB on Linux
+}
+
+// Returns the current resident set size of the process in bytes, or 0 if unknown.
+uint64_t current_rss() {
+  std::ifstream ifs{"/proc/self/statm"};
+  uint64_t size = 0, resident = 0;
+  ifs >> size >> resident;
+  return resident * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// Searches the keys partitioned into num_threads ranges, reporting the throughput and the latency
+// percentiles of each thread, which are sampled so that reading the clock does not slow the searches down.
+template<typename T>
+void search_keys(const T& bonsai, const char* file_name, uint32_t num_threads) {
+  constexpr uint64_t kSampleInterval = 16; // timing one of these searches
+
+  struct ThreadStats {
+    uint64_t ok;
+    uint64_t ng;
+    char pad[64]; // keeping the counters of threads in different cache lines wherever the vector starts
+  };
+
+  auto keys = read_keys(file_name);
+  std::vector<ThreadStats> stats(num_threads, ThreadStats{0, 0, {}});
+  std::vector<std::vector<double>> lats(num_threads); // sampled, in microseconds
+
+  StopWatch sw;
+  parallel_for(keys.size(), num_threads, [&](uint32_t thread_id, uint64_t begin, uint64_t end) {
+    auto& stat = stats[thread_id];
+    auto& thread_lats = lats[thread_id];
+    thread_lats.reserve((end - begin) / kSampleInterval + 1);
+    for (uint64_t i = begin; i < end; ++i) {
+      auto ptr = reinterpret_cast<const uint8_t*>(keys[i].c_str());
+      auto len = keys[i].size() + 1; // including terminators
+      if ((i - begin) % kSampleInterval != 0) {
+        bonsai.search(ptr, len) ? ++stat.ok : ++stat.ng;
+        continue;
+      }
+      const auto tp = std::chrono::steady_clock::now();
+      bonsai.search(ptr, len) ? ++stat.ok : ++stat.ng;
+      thread_lats.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tp).count());
+    }
+  });
+  const auto sec = sw(Times::sec);
+
+  uint64_t ok = 0, ng = 0;
+  for (const auto& stat : stats) {
+    ok += stat.ok;
+    ng += stat.ng;
+  }
+  std::cout << "OK: " << ok << ", NG: " << ng << std::endl;
+  std::cout << "search threads: " << num_threads << std::endl;
+  std::cout << "search throughput: " << keys.size() / sec << " (keys/sec)" << std::endl;
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    std::cout << "thread " << i << " latency p50/p99/p999: " << percentile(lats[i], 0.5) << " / "
+              << percentile(lats[i], 0.99) << " / " << percentile(lats[i], 0.999) << " (us)" << std::endl;
+  }
+}
+
+// Finds the keys occurring in each line of the text by moving a cursor byte by byte from each start position,
+// compared with searching each substring from the root until it is not a prefix of any key.
+template<typename T>
+void scan_text(const T& bonsai, const char* file_name) {
+  const auto lines = read_keys(file_name);
+  const uint8_t terminator = '\0'; // stored by the driver
+
+  uint64_t num_bytes = 0, num_matches = 0;
+  StopWatch sw;
+  for (const auto& line : lines) {
+    const auto str = reinterpret_cast<const uint8_t*>(line.data());
+    num_bytes += line.size();
+    for (uint64_t i = 0; i < line.size(); ++i) {
+      auto cursor = bonsai.root();
+      for (uint64_t j = i; j < line.size() && bonsai.child(cursor, str[j]); ++j) {
+        auto end = cursor;
+        num_matches += bonsai.child(end, terminator) && bonsai.is_final(end);
+      }
+    }
+  }
+  const auto scan_time = sw(Times::nano);
+
+  uint64_t num_rewalk_matches = 0;
+  StopWatch rewalk_sw;
+  for (const auto& line : lines) {
+    const auto str = reinterpret_cast<const uint8_t*>(line.c_str());
+    for (uint64_t i = 0; i < line.size(); ++i) {
+      std::string sub;
+      for (uint64_t j = i; j < line.size() && bonsai.contains_prefix(str + i, j - i + 1); ++j) {
+        sub.assign(line, i, j - i + 1);
+        sub.push_back('\0');
+        num_rewalk_matches += bonsai.search(reinterpret_cast<const uint8_t*>(sub.data()), sub.size());
+      }
+    }
+  }
+  const auto rewalk_time = rewalk_sw(Times::nano);
+
+  if (num_matches != num_rewalk_matches) {
+    std::cerr << "ERROR: " << num_matches << " matches by cursors, but " << num_rewalk_matches << std::endl;
+    exit(1);
+  }
+  std::cout << "scan matches: " << num_matches << std::endl;
+  std::cout << "scan time: " << scan_time / num_bytes << " (ns/byte)" << std::endl;
+  std::cout << "rewalk scan time: " << rewalk_time / num_bytes << " (ns/byte)" << std::endl;
+}
+
+template<typename T>
+void enable_filter(T& bonsai, const Options& opts) {
+  if (opts.filter_bits != 0) {
+    StopWatch sw;
+    bonsai.enable_filter(bonsai.num_strs(), opts.filter_bits);
+    std::cout << "filter time: " << sw(Times::milli) << " (ms)" << std::endl;
+  }
+}
+
+template<typename T>
+void enable_prefix_cache(T& bonsai, const Options& opts) {
+  if (opts.cache_depth != 0) {
+    bonsai.enable_prefix_cache(opts.cache_depth);
+  }
+}
+
+// Calls fn(ngram, n) for the n-grams up to order in each line, where begins are the offsets of lines in ids.
+template<typename F>
+void for_each_ngram(const std::vector<uint32_t>& ids, const std::vector<uint64_t>& begins, uint32_t order, F fn) {
+  for (uint64_t k = 0; k + 1 < begins.size(); ++k) {
+    for (uint64_t i = begins[k]; i < begins[k + 1]; ++i) {
+      for (uint64_t n = 1; n <= order && i + n <= begins[k + 1]; ++n) {
+        fn(ids.data() + i, n);
+      }
+    }
+  }
+}
+
+// Counts the n-grams up to ngram_order in each line of whitespace-separated words,
+// compared with a hash map from vectors of word IDs to counts.
+template<typename T>
+int ngram_benchmark(const char* argv[], const Options& opts) {
   auto num_nodes = static_cast<uint64_t>(std::atoll(argv[4]));
   double load_factor = std::atof(argv[5]);
   auto colls_bits = static_cast<uint8_t>(std::atoi(argv[6]));
 
-  // expecting that the concrete alphabet size is less than 253
-  T bonsai{(uint64_t) (num_nodes / load_factor), 253, colls_bits};
+  // word IDs are given in the order of appearance
+  std::unordered_map<std::string, uint32_t> vocab;
+  std::vector<uint32_t> ids;
+  std::vector<uint64_t> begins{0}; // of lines in ids
+  {
+    KeyReader reader{argv[1]};
+    if (!reader.is_ready()) {
+      std::cerr << "ERROR: failed to open " << argv[1] << std::endl;
+      return 1;
+    }
+    uint64_t len = 0;
+    while (auto line = reader.next(len)) {
+      for (uint64_t i = 0; i < len;) {
+        const auto end = std::find_if(line + i, line + len, [](char c) { return c == ' ' || c == '\t'; }) - line;
+        if (i < static_cast<uint64_t>(end)) {
+          const auto id = static_cast<uint32_t>(vocab.size());
+          ids.push_back(vocab.emplace(std::string{line + i, line + end}, id).first->second);
+        }
+        i = end + 1;
+      }
+      begins.push_back(ids.size());
+    }
+  }
+
+  T bonsai{(uint64_t) (num_nodes / load_factor), std::max<uint64_t>(vocab.size(), 2), colls_bits, opts.config};
+  bonsai.enable_counts();
   std::cout << "----- " << bonsai.name() << " -----" << std::endl;
+  std::cout << "vocabulary: " << vocab.size() << std::endl;
 
+  uint64_t num_ngrams = 0;
   {
+    StopWatch sw;
+    for_each_ngram(ids, begins, opts.ngram_order, [&](const uint32_t* ngram, uint64_t n) {
+      bonsai.insert(ngram, n);
+      ++num_ngrams;
+    });
+    std::cout << "ngrams: " << num_ngrams << ", distinct: " << bonsai.num_strs() << std::endl;
+    std::cout << "insert time: " << sw(Times::micro) / num_ngrams << " (us/ngram)" << std::endl;
+  }
+
+  struct VectorHash {
+    size_t operator()(const std::vector<uint32_t>& v) const {
+      return hash_bytes(v.data(), v.size() * sizeof(uint32_t));
+    }
+  };
+  std::unordered_map<std::vector<uint32_t>, uint64_t, VectorHash> baseline;
+  {
+    StopWatch sw;
+    for_each_ngram(ids, begins, opts.ngram_order, [&](const uint32_t* ngram, uint64_t n) {
+      ++baseline[std::vector<uint32_t>(ngram, ngram + n)];
+    });
+    std::cout << "baseline insert time: " << sw(Times::micro) / num_ngrams << " (us/ngram)" << std::endl;
+  }
+
+  {
+    StopWatch sw;
+    uint64_t ng = 0;
+    for (const auto& entry : baseline) {
+      ng += bonsai.count(entry.first.data(), entry.first.size()) != entry.second;
+    }
+    std::cout << "count NG: " << ng << std::endl;
+    std::cout << "count time: " << sw(Times::micro) / baseline.size() << " (us/ngram)" << std::endl;
+  }
+  {
+    StopWatch sw;
+    uint64_t sum = 0;
+    for (const auto& entry : baseline) {
+      sum += baseline.find(entry.first)->second;
+    }
+    std::cout << "baseline count time: " << sw(Times::micro) / baseline.size() << " (us/ngram)" << std::endl;
+    if (sum != num_ngrams) {
+      std::cerr << "ERROR: inconsistent baseline" << std::endl;
+    }
+  }
+
+  // buckets, nodes with a cached hash, and vector buffers with allocator headers
+  uint64_t baseline_bytes = baseline.bucket_count() * sizeof(void*);
+  for (const auto& entry : baseline) {
+    baseline_bytes += 2 * sizeof(void*) + sizeof(entry) + 16;
+    baseline_bytes += entry.first.capacity() * sizeof(uint32_t) + 16;
+  }
+  std::cout << "size baseline: " << baseline_bytes << std::endl;
+
+  bonsai.show_stat(std::cout);
+  return 0;
+}
+
+template<typename T>
+int benchmark(const char* argv[], const Options& opts) {
+  if (opts.ngram_order != 0) {
+    return ngram_benchmark<T>(argv, opts);
+  }
+
+  auto num_nodes = static_cast<uint64_t>(std::atoll(argv[4]));
+  double load_factor = std::atof(argv[5]);
+  auto colls_bits = static_cast<uint8_t>(std::atoi(argv[6]));
+
+  const auto rss = current_rss(), max_rss = peak_rss();
+
+  // expecting that the concrete alphabet size is less than 253
+  T bonsai{(uint64_t) (num_nodes / load_factor), 253, colls_bits, opts.config};
+  std::cout << "----- " << bonsai.name() << " -----" << std::endl;
+
+  // recovers the last image and the records logged after it
+  std::unique_ptr<WriteAheadLog> log;
+  if (opts.wal_name != nullptr) {
+    const auto img_name = std::string{opts.wal_name} + ".img";
+    StopWatch sw;
+    std::ifstream ifs{img_name, std::ios::binary};
+    if (ifs) {
+      bonsai.load(ifs);
+    }
+    auto num_records = WriteAheadLog::replay(opts.wal_name, bonsai);
+    std::cout << "recovered keys: " << bonsai.num_strs() << " (" << num_records << " replayed)" << std::endl;
+    std::cout << "recovery time: " << sw(Times::milli) << " (ms)" << std::endl;
+
+    log.reset(new WriteAheadLog{opts.wal_name});
+    bonsai.attach_log(log.get());
+  }
+
+  enable_prefix_cache(bonsai, opts); // filled by the insertions
+
+  if (std::strcmp(argv[1], "-") != 0) { // or only recovering
     KeyReader reader{argv[1]};
     if (!reader.is_ready()) {
       std::cerr << "ERROR: failed to open " << argv[1] << std::endl;
       return 1;
     }
 
+    const auto num_strs = bonsai.num_strs();
     StopWatch sw;
-    while (true) {
-      const auto& key = reader.next();
-      if (key.empty()) {
-        break;
+    uint64_t len = 0;
+    if (opts.batch_size == 0) {
+      while (auto key = reader.next(len)) {
+        if (len == 0) {
+          continue;
+        }
+        auto ptr = reinterpret_cast<const uint8_t*>(key);
+        bonsai.insert(ptr, len + 1); // including terminators
+      }
+    } else {
+      std::vector<std::string> keys;
+      keys.reserve(opts.batch_size);
+      while (true) {
+        auto key = reader.next(len);
+        if (key != nullptr && len != 0) {
+          keys.emplace_back(key, len + 1); // including terminators
+        }
+        if (keys.size() == opts.batch_size || (key == nullptr && !keys.empty())) {
+          insert_all(bonsai, keys);
+          keys.clear();
+        }
+        if (key == nullptr) {
+          break;
+        }
       }
-      auto ptr = reinterpret_cast<const uint8_t*>(key.c_str());
-      auto len = key.size() + 1; // including terminators
-      bonsai.insert(ptr, len);
     }
-    std::cout << "insert time: " << sw(Times::micro) / bonsai.num_strs() << " (us/key)" << std::endl;
+    if (log) {
+      log->sync();
+    }
+    std::cout << "insert time: " << sw(Times::micro) / (bonsai.num_strs() - num_strs) << " (us/key)" << std::endl;
   }
 
-  if (std::strcmp(argv[2], "-") != 0) {
-    auto keys = read_keys(argv[2]);
-    uint64_t ok = 0, ng = 0;
+  if (opts.config.file != nullptr) {
     StopWatch sw;
-    for (const auto& key : keys) {
-      auto ptr = reinterpret_cast<const uint8_t*>(key.c_str());
-      auto len = key.size() + 1; // including terminators
-      if (bonsai.search(ptr, len)) {
-        ++ok;
-      } else {
-        ++ng;
-      }
-    }
-    std::cout << "OK: " << ok << ", NG: " << ng << std::endl;
-    std::cout << "search time: " << sw(Times::micro) / keys.size() << " (us/key)" << std::endl;
+    bonsai.sync();
+    std::cout << "sync time: " << sw(Times::milli) << " (ms)" << std::endl;
+  }
+
+  // cross-checking the accounting, where the peak RSS also grows by the buffers of reading keys, freed by now
+  const auto memory = bonsai.memory_usage().total();
+  const auto rss_growth = current_rss() - rss;
+  std::cout << "memory usage: " << memory << " (bytes)" << std::endl;
+  std::cout << "RSS growth: " << rss_growth << " (bytes, " << 100.0 * memory / rss_growth << "% accounted)" << std::endl;
+  std::cout << "peak RSS growth: " << peak_rss() - max_rss << " (bytes)" << std::endl;
+
+  // saves a new image and truncates the log covered by it
+  if (log) {
+    std::cout << "log syncs: " << log->num_syncs() << std::endl;
+    log->checkpoint(bonsai, std::string{opts.wal_name} + ".img");
+  }
+
+  enable_filter(bonsai, opts);
+  if (std::strcmp(argv[2], "-") != 0 && opts.num_threads != 0) {
+    search_keys(bonsai, argv[2], opts.num_threads);
+  } else if (std::strcmp(argv[2], "-") != 0) {
+    search_keys(bonsai, argv[2]);
+  }
+  if (opts.scan_name != nullptr) {
+    scan_text(bonsai, opts.scan_name);
+  }
+
+#ifdef __linux__
+  if (opts.socket_name != nullptr) {
+    Server<T> server{bonsai, opts.socket_name, log.get()};
+    std::cout << "serving on " << opts.socket_name << std::endl;
+    StopWatch sw;
+    server.run();
+    std::cout << "served requests: " << server.num_served() << " (" << server.num_batches() << " batches)" << std::endl;
+    std::cout << "serve time: " << sw(Times::sec) << " (sec)" << std::endl;
   }
+#endif
 
   bonsai.show_stat(std::cout);
   return 0;
@@ -185,18 +568,19 @@ int benchmark(const char* argv[]) {
 
 int main(int argc, const char* argv[]) {
   std::ostringstream usage;
-  usage << argv[0] << " <key> <query> <type> <#nodes> <load_factor> <colls_bits>";
+  usage << argv[0] << " <key> <query> <type> <#nodes> <load_factor> <colls_bits> [--blocked] [--pages normal|thp|2m|1g] [--numa interleave|local] [--file <slots>] [--wal <file>] [--batch <#keys>] [--filter <bits_per_key>] [--prefix-cache <depth>] [--serve <socket>] [--ngram <order>] [--threads <#threads>] [--scan <text>]";
 
   if (argc == 2) {
     std::cout << "#nodes: " << count_num_nodes(argv[1]) << std::endl;
     return 0;
   }
 
-  if (argc == 7) {
+  Options opts;
+  if (7 <= argc && parse_options(argc, argv, opts)) {
     if (*argv[3] == '1') {
-      return benchmark<BonsaiDCW>(argv);
+      return benchmark<BonsaiDCW>(argv, opts);
     } else if (*argv[3] == '2') {
-      return benchmark<BonsaiPR>(argv);
+      return benchmark<BonsaiPR>(argv, opts);
     }
   }
 
@@ -0,0 +1,188 @@
+#include <cstring>
+#include <fstream>
+
+#include <poll.h>
+
+#include "Server.hpp"
+
+using namespace bonsais;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  uint32_t num_conns = 4;
+  uint64_t depth = 64; // outstanding requests per connection
+  uint64_t num_requests = 1000000;
+  Op op = Op::search;
+  bool shutdown = false;
+};
+
+bool parse_options(int argc, const char* argv[], Options& opts) {
+  for (int i = 3; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--conns") == 0 && i + 1 < argc) {
+      opts.num_conns = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+    } else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+      opts.depth = static_cast<uint64_t>(std::max(std::atoll(argv[++i]), 1LL));
+    } else if (std::strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+      opts.num_requests = static_cast<uint64_t>(std::atoll(argv[++i]));
+    } else if (std::strcmp(argv[i], "--op") == 0 && i + 1 < argc) {
+      const char* op = argv[++i];
+      if (std::strcmp(op, "search") == 0) {
+        opts.op = Op::search;
+      } else if (std::strcmp(op, "insert") == 0) {
+        opts.op = Op::insert;
+      } else if (std::strcmp(op, "prefix") == 0) {
+        opts.op = Op::prefix;
+      } else {
+        std::cerr << "ERROR: unknown op " << op << std::endl;
+        return false;
+      }
+    } else if (std::strcmp(argv[i], "--shutdown") == 0) {
+      opts.shutdown = true;
+    } else {
+      std::cerr << "ERROR: unknown option " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int connect_to(const char* path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "ERROR: failed to connect to " << path << std::endl;
+    exit(1);
+  }
+  return fd;
+}
+
+struct Connection {
+  int fd;
+  std::string out;
+  uint64_t out_pos;
+  std::vector<Clock::time_point> sent_at; // ring of the outstanding requests
+  uint64_t num_sent;
+  uint64_t num_received;
+};
+
+}
+
+// Sends requests of the queries through pipelined connections and reports QPS and tail latencies,
+// where each latency is from queuing a request to receiving its reply.
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <socket> <query> [--conns <#connections>] [--depth <#outstanding>] [--requests <#requests>] [--op search|insert|prefix] [--shutdown]";
+
+  Options opts;
+  if (argc < 3 || !parse_options(argc, argv, opts)) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> keys;
+  {
+    std::ifstream ifs{argv[2]};
+    for (std::string line; std::getline(ifs, line);) {
+      if (!line.empty()) {
+        if (opts.op != Op::prefix) {
+          line.push_back('\0'); // terminators are stored by the driver
+        }
+        keys.push_back(line);
+      }
+    }
+  }
+  if (keys.empty()) {
+    std::cerr << "ERROR: no queries in " << argv[2] << std::endl;
+    return 1;
+  }
+
+  std::vector<Connection> conns(opts.num_conns);
+  std::vector<pollfd> fds(opts.num_conns);
+  for (uint32_t i = 0; i < opts.num_conns; ++i) {
+    conns[i] = {connect_to(argv[1]), std::string{}, 0, std::vector<Clock::time_point>(opts.depth), 0, 0};
+    ::fcntl(conns[i].fd, F_SETFL, ::fcntl(conns[i].fd, F_GETFL) | O_NONBLOCK);
+    fds[i].fd = conns[i].fd;
+  }
+
+  std::vector<double> lats; // in microseconds
+  lats.reserve(opts.num_requests);
+  std::vector<char> buf(1U << 16);
+  uint64_t num_queued = 0, num_hits = 0;
+
+  const auto begin = Clock::now();
+  while (lats.size() < opts.num_requests) {
+    for (uint32_t i = 0; i < opts.num_conns; ++i) {
+      auto& conn = conns[i];
+      const auto now = Clock::now();
+      while (conn.num_sent - conn.num_received < opts.depth && num_queued < opts.num_requests) {
+        const auto& key = keys[num_queued++ % keys.size()];
+        append_request(conn.out, opts.op, key.data(), static_cast<uint32_t>(key.size()));
+        conn.sent_at[conn.num_sent++ % opts.depth] = now;
+      }
+      while (conn.out_pos < conn.out.size()) {
+        const auto ret = ::send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (ret <= 0) {
+          break;
+        }
+        conn.out_pos += ret;
+      }
+      if (conn.out_pos == conn.out.size()) {
+        conn.out.clear();
+        conn.out_pos = 0;
+      }
+      fds[i].events = POLLIN | (conn.out.empty() ? 0 : POLLOUT);
+    }
+
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      std::cerr << "ERROR: failed to poll" << std::endl;
+      return 1;
+    }
+
+    for (uint32_t i = 0; i < opts.num_conns; ++i) {
+      if (fds[i].revents & (POLLERR | POLLHUP)) {
+        std::cerr << "ERROR: connection closed by the server" << std::endl;
+        return 1;
+      }
+      if (!(fds[i].revents & POLLIN)) {
+        continue;
+      }
+      auto& conn = conns[i];
+      const auto ret = ::recv(conn.fd, buf.data(), buf.size(), 0);
+      const auto now = Clock::now();
+      for (ssize_t j = 0; j < ret; ++j) {
+        const auto lat = now - conn.sent_at[conn.num_received++ % opts.depth];
+        lats.push_back(std::chrono::duration<double, std::micro>(lat).count());
+        num_hits += buf[j] != 0;
+      }
+    }
+  }
+  const double sec = std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::cout << "requests: " << lats.size() << ", hits: " << num_hits << std::endl;
+  std::cout << "QPS: " << lats.size() / sec << std::endl;
+  std::cout << "latency p50: " << percentile(lats, 0.5) << " (us)" << std::endl;
+  std::cout << "latency p99: " << percentile(lats, 0.99) << " (us)" << std::endl;
+  std::cout << "latency p999: " << percentile(lats, 0.999) << " (us)" << std::endl;
+
+  if (opts.shutdown) {
+    std::string req;
+    append_request(req, Op::shutdown, "", 0);
+    const int fd = connect_to(argv[1]);
+    char reply = 0;
+    if (::send(fd, req.data(), req.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(req.size())
+        || ::recv(fd, &reply, 1, 0) != 1) {
+      std::cerr << "ERROR: failed to shut down the server" << std::endl;
+    }
+    ::close(fd);
+  }
+
+  for (auto& conn : conns) {
+    ::close(conn.fd);
+  }
+  return 0;
+}
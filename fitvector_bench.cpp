@@ -0,0 +1,178 @@
+#include "FitVector.hpp"
+
+using namespace bonsais;
+
+namespace {
+
+constexpr uint64_t kNumOps = 1U << 20;
+
+uint64_t sink = 0; // keeping results alive
+
+// xorshift64*
+class Random {
+public:
+  explicit Random(uint64_t seed) : state_{seed} {}
+
+  uint64_t operator()() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * UINT64_C(2685821657736338717);
+  }
+
+private:
+  uint64_t state_;
+};
+
+// sequential, random, or strided so that each access touches a new cache line
+std::vector<uint64_t> make_indices(const std::string& pattern, uint64_t length, uint8_t width) {
+  std::vector<uint64_t> ret(kNumOps);
+  Random rnd{length * 64 + width};
+  const uint64_t stride = FitVector::kLineWidth / width + 1;
+  for (uint64_t k = 0, i = 0; k < kNumOps; ++k) {
+    if (pattern == "seq") {
+      ret[k] = k % length;
+    } else if (pattern == "random") {
+      ret[k] = rnd() % length;
+    } else {
+      ret[k] = i;
+      i = (i + stride) % length;
+    }
+  }
+  return ret;
+}
+
+// Returns ns/op of fn() doing kNumOps operations.
+template<typename F>
+double measure(F fn) {
+  fn(); // warming up
+  StopWatch sw;
+  fn();
+  return sw(Times::nano) / kNumOps;
+}
+
+void report(const FitVector& vec, uint64_t bytes, const char* pattern, const char* op, double ns) {
+  std::cout << (vec.blocked() ? "blocked" : "flat") << "\t" << (uint32_t) vec.width() << "\t" << bytes
+            << "\t" << pattern << "\t" << op << "\t" << ns << std::endl;
+}
+
+// Checks the bulk kernels reading vec (get_many() for indices and unpack() from the beginning)
+// against get(), exiting on a mismatch.
+void verify(const FitVector& vec, const std::vector<uint64_t>& indices, const char* pattern) {
+  auto fail = [&](const char* op, uint64_t i) {
+    std::cerr << "ERROR: " << op << " mismatches get() at " << i << " (" << (vec.blocked() ? "blocked" : "flat")
+              << ", width " << (uint32_t) vec.width() << ", " << pattern << ")" << std::endl;
+    exit(1);
+  };
+
+  std::vector<uint64_t> out(indices.size());
+  vec.get_many(indices.data(), indices.size(), out.data());
+  for (uint64_t k = 0; k < indices.size(); ++k) {
+    if (out[k] != vec.get(indices[k])) {
+      fail("get_many", indices[k]);
+    }
+  }
+
+  if (vec.width() <= 32) {
+    const auto num = std::min<uint64_t>(indices.size(), vec.length());
+    std::vector<uint32_t> buf(num);
+    vec.unpack(0, num, buf.data());
+    for (uint64_t i = 0; i < num; ++i) {
+      if (buf[i] != vec.get(i)) {
+        fail("unpack", i);
+      }
+    }
+  }
+}
+
+void bench(uint8_t width, uint64_t bytes, bool blocked) {
+  VectorConfig config;
+  config.blocked = blocked;
+  const uint64_t length = std::max<uint64_t>(bytes * 8 / width, 1);
+  FitVector vec{length, width, 0, config};
+
+  std::vector<uint64_t> vals(kNumOps);
+  Random rnd{width};
+  for (auto& val : vals) {
+    val = rnd();
+  }
+  std::vector<uint64_t> out(kNumOps);
+
+  for (const char* pattern : {"seq", "random", "strided"}) {
+    const auto indices = make_indices(pattern, length, width);
+    for (uint64_t k = 0; k < kNumOps; ++k) {
+      vec.set(indices[k], vals[k]);
+    }
+    verify(vec, indices, pattern);
+
+    report(vec, bytes, pattern, "get", measure([&] {
+      uint64_t sum = 0;
+      for (auto i : indices) {
+        sum += vec.get(i);
+      }
+      sink += sum;
+    }));
+    report(vec, bytes, pattern, "set", measure([&] {
+      for (uint64_t k = 0; k < kNumOps; ++k) {
+        vec.set(indices[k], vals[k]);
+      }
+    }));
+    report(vec, bytes, pattern, "rmw", measure([&] {
+      for (auto i : indices) {
+        vec.set(i, vec.get(i) + 1);
+      }
+    }));
+    report(vec, bytes, pattern, "get_many", measure([&] {
+      vec.get_many(indices.data(), kNumOps, out.data());
+      sink += out[kNumOps - 1];
+    }));
+    report(vec, bytes, pattern, "set_many", measure([&] {
+      vec.set_many(indices.data(), vals.data(), kNumOps);
+    }));
+  }
+
+  if (width <= 32) {
+    std::vector<uint32_t> buf(kNumOps);
+    report(vec, bytes, "seq", "unpack", measure([&] {
+      for (uint64_t k = 0; k < kNumOps;) {
+        const auto num = std::min(kNumOps - k, length);
+        vec.unpack(0, num, buf.data() + k);
+        k += num;
+      }
+      sink += buf[kNumOps - 1];
+    }));
+  }
+}
+
+}
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " [max_bytes] [width_step]";
+
+  if (3 < argc) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  const uint64_t max_bytes = 2 <= argc ? static_cast<uint64_t>(std::atoll(argv[1])) : UINT64_C(1) << 28;
+  const uint32_t width_step = 3 <= argc ? std::max(std::atoi(argv[2]), 1) : 1;
+
+  // from L1-resident to DRAM-bound
+  std::vector<uint64_t> sizes;
+  for (uint64_t bytes : {UINT64_C(1) << 14, UINT64_C(1) << 18, UINT64_C(1) << 23, UINT64_C(1) << 28}) {
+    if (bytes <= max_bytes) {
+      sizes.push_back(bytes);
+    }
+  }
+
+  std::cout << "layout\twidth\tbytes\tpattern\top\tns/op" << std::endl;
+  for (uint32_t width = 1; width <= 64; width += width_step) {
+    for (auto bytes : sizes) {
+      bench(static_cast<uint8_t>(width), bytes, false);
+      bench(static_cast<uint8_t>(width), bytes, true);
+    }
+  }
+  std::cerr << "checksum: " << sink << std::endl;
+  return 0;
+}